@@ -0,0 +1,50 @@
+(* On-device check of the minor heap words allocated per call by the per-frame externals and
+   their result wrappers. Build with [jbuilder build -x esp32 bench/alloc/alloc_bench.exe].
+
+   Reads run on an idle station and writes send ESP-NOW broadcasts, so both paths are exercised
+   without an access point or a peer. The count of successful calls is printed with each line,
+   since only [Ok n] results allocate. *)
+
+let calls = 10_000
+
+let frame_length = 6 + 32
+
+let measure name f =
+    let ok = ref 0 in
+    let before = Gc.minor_words () in
+    for _ = 1 to calls do
+        if Sys.opaque_identity (f ()) then incr ok
+    done;
+    let words = Gc.minor_words () -. before in
+    Printf.printf "%-24s %6.3f words/call (%d/%d ok)\n%!" name (words /. float calls) !ok calls
+
+let check name = function
+    | Ok _ -> ()
+    | Error _ -> failwith name
+
+let () =
+    check "initialize" (Wifi.initialize ());
+    check "set_mode" (Wifi.set_mode Wifi.MODE_STA);
+    check "start" (Wifi.start ());
+    check "espnow_start" (Wifi.espnow_start ());
+    check "espnow_add_peer" (Wifi.espnow_add_peer {
+        Wifi.peer_mac = Bytes.make 6 '\xff';
+        peer_channel = 0;
+        peer_interface = Wifi.IF_STA;
+        peer_lmk = None;
+    });
+
+    let rx = Cstruct.create 1600 in
+    let tx = Cstruct.create frame_length in
+    Cstruct.memset tx 0xff;
+    let rx_buf = rx.Cstruct.buffer and rx_len = Cstruct.len rx in
+    let tx_buf = tx.Cstruct.buffer in
+
+    (* Gc.minor_words itself allocates a float, this gives the per-call floor of the method. *)
+    measure "baseline" (fun () -> true);
+    measure "read_raw" (fun () -> Wifi.read_raw Wifi.IF_STA rx_buf rx_len >= 0);
+    measure "read" (fun () -> match Wifi.read Wifi.IF_STA rx_buf rx_len with Ok _ -> true | Error _ -> false);
+    measure "write_raw" (fun () -> Wifi.write_raw Wifi.IF_ESPNOW tx_buf frame_length >= 0);
+    measure "write" (fun () -> match Wifi.write Wifi.IF_ESPNOW tx_buf frame_length with Ok _ -> true | Error _ -> false);
+    measure "get_status_bits" (fun () -> Wifi.get_status_bits () >= 0);
+    measure "get_status" (fun () -> (Wifi.get_status ()).Wifi.inited)
@@ -0,0 +1 @@
+/* wifi_lib.c does not use the OCaml runtime. */
@@ -0,0 +1,243 @@
+/*
+ Just enough of the ESP-IDF v3 and FreeRTOS API for wifi_lib.c to build and run on a host, 
+ implemented over pthreads in shim.c. Types only match the real ones where wifi_lib.c relies on them.
+ */
+#ifndef IDF_SHIM_H
+#define IDF_SHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef int esp_err_t;
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#define ESP_ERR_NO_MEM              0x101
+#define ESP_ERR_INVALID_ARG         0x102
+#define ESP_ERR_INVALID_STATE       0x103
+#define ESP_ERR_NOT_SUPPORTED       0x106
+#define ESP_ERROR_CHECK(x)          (void)(x)
+
+#define BIT0    0x00000001
+#define BIT1    0x00000002
+#define BIT2    0x00000004
+#define BIT3    0x00000008
+#define BIT4    0x00000010
+#define BIT5    0x00000020
+#define BIT6    0x00000040
+#define BIT7    0x00000080
+#define BIT8    0x00000100
+#define BIT9    0x00000200
+#define BIT10   0x00000400
+
+/* FreeRTOS */
+typedef int         BaseType_t;
+typedef unsigned    UBaseType_t;
+typedef uint32_t    TickType_t;
+typedef uint32_t    EventBits_t;
+typedef struct shim_queue*       QueueHandle_t;
+typedef struct shim_event_group* EventGroupHandle_t;
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define configTICK_RATE_HZ  100
+#define portMAX_DELAY       ((TickType_t) 0xffffffff)
+
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { PTHREAD_MUTEX_INITIALIZER }
+void portENTER_CRITICAL(portMUX_TYPE* mux);
+void portEXIT_CRITICAL(portMUX_TYPE* mux);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+/* Nothing runs in interrupt context here, these behave as their task versions with no wait. */
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* woken);
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void* item, BaseType_t* woken);
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t queue);
+
+EventGroupHandle_t xEventGroupCreate(void);
+void vEventGroupDelete(EventGroupHandle_t group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks);
+
+/* esp_timer */
+typedef struct shim_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef enum { ESP_TIMER_TASK } esp_timer_dispatch_t;
+typedef struct {
+    esp_timer_cb_t       callback;
+    void*                arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char*          name;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* timer);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+/* Wi-Fi */
+typedef enum { ESP_IF_WIFI_STA = 0, ESP_IF_WIFI_AP, ESP_IF_ETH, ESP_IF_MAX } esp_interface_t;
+typedef esp_interface_t wifi_interface_t;
+#define WIFI_IF_STA ESP_IF_WIFI_STA
+#define WIFI_IF_AP  ESP_IF_WIFI_AP
+
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA, WIFI_MODE_AP, WIFI_MODE_APSTA } wifi_mode_t;
+typedef enum { WIFI_AUTH_OPEN, WIFI_AUTH_WEP, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WPA2_PSK, WIFI_AUTH_WPA_WPA2_PSK, WIFI_AUTH_WPA2_ENTERPRISE } wifi_auth_mode_t;
+typedef enum { WIFI_FAST_SCAN, WIFI_ALL_CHANNEL_SCAN } wifi_scan_method_t;
+typedef enum { WIFI_CONNECT_AP_BY_SIGNAL, WIFI_CONNECT_AP_BY_SECURITY } wifi_sort_method_t;
+typedef enum { WIFI_STORAGE_FLASH, WIFI_STORAGE_RAM } wifi_storage_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    uint8_t ssid_len;
+    uint8_t channel;
+    wifi_auth_mode_t authmode;
+    uint8_t ssid_hidden;
+    uint8_t max_connection;
+    uint16_t beacon_interval;
+} wifi_ap_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    wifi_scan_method_t scan_method;
+    bool bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+    wifi_sort_method_t sort_method;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_ap_config_t  ap;
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    wifi_auth_mode_t authmode;
+} wifi_ap_record_t;
+
+typedef struct {
+    uint8_t* ssid;
+    uint8_t* bssid;
+    uint8_t channel;
+    bool show_hidden;
+} wifi_scan_config_t;
+
+typedef struct {
+    int static_rx_buf_num;
+    int dynamic_rx_buf_num;
+    int static_tx_buf_num;
+    int nvs_enable;
+} wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() { 0 }
+
+esp_err_t esp_wifi_init_internal(wifi_init_config_t* config);
+esp_err_t esp_wifi_deinit(void);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_get_mode(wifi_mode_t* mode);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* config);
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t* config);
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t* config, bool block);
+esp_err_t esp_wifi_scan_stop(void);
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t* number);
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t* number, wifi_ap_record_t* records);
+esp_err_t esp_wifi_get_mac(wifi_interface_t interface, uint8_t* mac);
+
+typedef esp_err_t (*wifi_rxcb_t)(void* buffer, uint16_t len, void* eb);
+esp_err_t esp_wifi_internal_reg_rxcb(wifi_interface_t interface, wifi_rxcb_t fn);
+void esp_wifi_internal_free_rx_buffer(void* eb);
+int esp_wifi_internal_tx(wifi_interface_t interface, void* buffer, uint16_t len);
+
+/* Events */
+typedef enum {
+    SYSTEM_EVENT_WIFI_READY, SYSTEM_EVENT_SCAN_DONE, SYSTEM_EVENT_STA_START, SYSTEM_EVENT_STA_STOP, 
+    SYSTEM_EVENT_STA_CONNECTED, SYSTEM_EVENT_STA_DISCONNECTED, SYSTEM_EVENT_STA_AUTHMODE_CHANGE, 
+    SYSTEM_EVENT_STA_GOT_IP, SYSTEM_EVENT_AP_START, SYSTEM_EVENT_AP_STOP, SYSTEM_EVENT_AP_STACONNECTED, 
+    SYSTEM_EVENT_AP_STADISCONNECTED
+} system_event_id_t;
+
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t channel; wifi_auth_mode_t authmode; } system_event_sta_connected_t;
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t reason; } system_event_sta_disconnected_t;
+typedef struct { uint8_t mac[6]; uint8_t aid; } system_event_ap_staconnected_t;
+typedef struct { uint8_t mac[6]; uint8_t aid; } system_event_ap_stadisconnected_t;
+
+typedef union {
+    system_event_sta_connected_t      connected;
+    system_event_sta_disconnected_t   disconnected;
+    system_event_ap_staconnected_t    sta_connected;
+    system_event_ap_stadisconnected_t sta_disconnected;
+} system_event_info_t;
+
+typedef struct {
+    system_event_id_t   event_id;
+    system_event_info_t event_info;
+} system_event_t;
+
+typedef esp_err_t (*system_event_cb_t)(void* ctx, system_event_t* event);
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void* ctx);
+
+/* NVS */
+typedef uint32_t nvs_handle;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode;
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_open(const char* name, nvs_open_mode mode, nvs_handle* handle);
+void nvs_close(nvs_handle handle);
+esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out, size_t* length);
+esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length);
+esp_err_t nvs_erase_key(nvs_handle handle, const char* key);
+esp_err_t nvs_commit(nvs_handle handle);
+
+/* ESP-NOW */
+#define ESP_NOW_ETH_ALEN            6
+#define ESP_NOW_KEY_LEN             16
+#define ESP_NOW_MAX_DATA_LEN        250
+#define ESP_ERR_ESPNOW_ARG          0x3066
+#define ESP_ERR_ESPNOW_NOT_FOUND    0x3069
+
+typedef enum { ESP_NOW_SEND_SUCCESS = 0, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
+
+typedef struct {
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+    uint8_t lmk[ESP_NOW_KEY_LEN];
+    uint8_t channel;
+    wifi_interface_t ifidx;
+    bool encrypt;
+    void* priv;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_recv_cb_t)(const uint8_t* mac, const uint8_t* data, int len);
+typedef void (*esp_now_send_cb_t)(const uint8_t* mac, esp_now_send_status_t status);
+esp_err_t esp_now_init(void);
+esp_err_t esp_now_deinit(void);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb);
+esp_err_t esp_now_send(const uint8_t* mac, const uint8_t* data, size_t len);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer);
+esp_err_t esp_now_mod_peer(const esp_now_peer_info_t* peer);
+esp_err_t esp_now_del_peer(const uint8_t* mac);
+bool esp_now_is_peer_exist(const uint8_t* mac);
+esp_err_t esp_now_set_pmk(const uint8_t* pmk);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ ESP-NOW loopback through wifi_lib.c on a host.
+
+ Frames written with wifi_write(WIFI_IF_ESPNOW) go through espnow_write and the stubbed esp_now_send
+ to a radio thread, which calls espnow_send_cb and espnow_recv_cb back like the Wi-Fi task would.
+ espnow_recv_cb queues them with rx_queue_push, and this thread waits on the event group and reads
+ them back with wifi_read, the way the OCaml side does.
+
+ This measures the driver-independent part of the path: the copies, queue and event group operations,
+ locks and the hand-off between two tasks. Host threads are not ESP32 tasks, so the numbers only
+ compare versions of wifi_lib.c with each other.
+ */
+#include <string.h>
+#include <time.h>
+
+#include "idf_shim.h"
+#include "shim.h"
+#include "wifi.h"
+
+#define ESPNOW_ADDR_LEN 6
+#define MAX_SAMPLES     100000
+
+static EventGroupHandle_t events;
+static int64_t samples[MAX_SAMPLES];
+
+static int64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int compare_samples(const void* a, const void* b) {
+    int64_t x = *(const int64_t*) a;
+    int64_t y = *(const int64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void fill_frame(uint8_t* frame, size_t size, uint32_t seq) {
+    static const uint8_t peer[ESPNOW_ADDR_LEN] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+
+    memcpy(frame, peer, ESPNOW_ADDR_LEN);
+    memset(frame + ESPNOW_ADDR_LEN, 0x5a, size - ESPNOW_ADDR_LEN);
+    memcpy(frame + ESPNOW_ADDR_LEN, &seq, sizeof(seq));
+}
+
+static void send_frame(size_t size, uint32_t seq) {
+    uint8_t frame[ESPNOW_ADDR_LEN + ESP_NOW_MAX_DATA_LEN];
+
+    fill_frame(frame, size, seq);
+    if (wifi_write(WIFI_IF_ESPNOW, frame, &size) != WIFI_ERR_OK) {
+        fprintf(stderr, "wifi_write failed\n");
+        exit(1);
+    }
+}
+
+/*
+ Waits for the received bit then drains the queue, returns the number of frames read.
+ */
+static int receive_frames(size_t size, uint32_t* expected) {
+    uint8_t frame[ESPNOW_ADDR_LEN + ESP_NOW_MAX_DATA_LEN];
+    uint32_t seq;
+    int count = 0;
+
+    EventBits_t bits = xEventGroupWaitBits(events, ESP_ESPNOW_FRAME_RECEIVED_BIT, pdFALSE, pdFALSE, configTICK_RATE_HZ);
+    if ((bits & ESP_ESPNOW_FRAME_RECEIVED_BIT) == 0) {
+        fprintf(stderr, "timed out waiting for frame %u\n", *expected);
+        exit(1);
+    }
+    for (;;) {
+        size_t length = sizeof(frame);
+        int res = wifi_read(WIFI_IF_ESPNOW, frame, &length);
+        if (res == WIFI_ERR_AGAIN) {
+            return count;
+        }
+        memcpy(&seq, frame + ESPNOW_ADDR_LEN, sizeof(seq));
+        if (res != WIFI_ERR_OK || length != size || seq != *expected) {
+            fprintf(stderr, "bad frame %u: res %d, length %zu, expected %u\n", seq, res, length, *expected);
+            exit(1);
+        }
+        (*expected)++;
+        count++;
+    }
+}
+
+static void bench_latency(size_t size, int rounds) {
+    uint32_t expected = 0;
+
+    for (int i = 0; i < rounds; i++) {
+        int64_t start = now_ns();
+        send_frame(size, i);
+        while (receive_frames(size, &expected) == 0) {
+        }
+        samples[i] = now_ns() - start;
+    }
+    qsort(samples, rounds, sizeof(samples[0]), compare_samples);
+    printf("round trip  %3zu bytes: min %6.2f us, p50 %6.2f us, p99 %6.2f us, max %8.2f us\n",
+        size - ESPNOW_ADDR_LEN,
+        samples[0] / 1e3, samples[rounds / 2] / 1e3, samples[rounds * 99 / 100] / 1e3, samples[rounds - 1] / 1e3);
+}
+
+/*
+ Keeps `window` frames in flight, the queue holds 20 so none are dropped.
+ */
+static void bench_throughput(size_t size, int frames, int window) {
+    wifi_rx_stats before = wifi_get_rx_stats(WIFI_IF_ESPNOW);
+    uint32_t expected = 0;
+    int sent = 0;
+
+    int64_t start = now_ns();
+    while (sent < window) {
+        send_frame(size, sent++);
+    }
+    while (expected < (uint32_t) frames) {
+        int count = receive_frames(size, &expected);
+        while (count-- > 0 && sent < frames) {
+            send_frame(size, sent++);
+        }
+    }
+    int64_t elapsed = now_ns() - start;
+    wifi_rx_stats after = wifi_get_rx_stats(WIFI_IF_ESPNOW);
+
+    printf("throughput  %3zu bytes, window %2d: %8.0f frames/s, %7.2f MB/s payload, %.2f wakeups/frame\n",
+        size - ESPNOW_ADDR_LEN, window,
+        frames * 1e9 / elapsed,
+        (double) frames * (size - ESPNOW_ADDR_LEN) * 1e3 / elapsed,
+        (double) (after.wakeups - before.wakeups) / (after.frames - before.frames));
+}
+
+int main(int argc, char** argv) {
+    static const size_t sizes[] = { ESPNOW_ADDR_LEN + 16, ESPNOW_ADDR_LEN + ESP_NOW_MAX_DATA_LEN };
+    int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+
+    if (rounds <= 0 || rounds > MAX_SAMPLES) {
+        fprintf(stderr, "usage: %s [rounds <= %d]\n", argv[0], MAX_SAMPLES);
+        return 1;
+    }
+
+    events = xEventGroupCreate();
+    wifi_set_event_group(events, 0);
+    if (wifi_initialize() != ESP_OK || wifi_espnow_start() != ESP_OK) {
+        fprintf(stderr, "initialization failed\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_latency(sizes[i], rounds);
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_throughput(sizes[i], rounds, 1);
+        bench_throughput(sizes[i], rounds, 16);
+    }
+
+    wifi_set_rx_coalescing(8, 200);
+    printf("rx coalescing 8 frames / 200 us:\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_throughput(sizes[i], rounds, 16);
+    }
+
+    wifi_espnow_stats st = wifi_espnow_get_stats();
+    printf("espnow stats: %u sent, %u failed, %u pending, %u dropped\n",
+        st.tx_success, st.tx_fail, st.tx_pending, st.rx_dropped);
+    return 0;
+}
@@ -0,0 +1,447 @@
+/*
+ Host implementation of the FreeRTOS and ESP-IDF calls made by wifi_lib.c.
+ Queues and event groups are built over a mutex and a condition variable, esp_timer over one thread per timer.
+ ESP-NOW sends are looped back through a "radio" thread standing in for the Wi-Fi task,
+ which calls the registered send and receive callbacks like the real driver does.
+ Everything else succeeds without doing anything.
+ */
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "idf_shim.h"
+#include "shim.h"
+
+static void deadline_after(struct timespec* ts, uint64_t us) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec  += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void cond_init(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/*
+ Waits on `cond` until woken or `ticks` have elapsed. Returns false on timeout.
+ */
+static bool cond_wait_ticks(pthread_cond_t* cond, pthread_mutex_t* mutex, TickType_t ticks) {
+    struct timespec deadline;
+
+    if (ticks == 0) {
+        return false;
+    }
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    deadline_after(&deadline, (uint64_t) ticks * 1000000 / configTICK_RATE_HZ);
+    return pthread_cond_timedwait(cond, mutex, &deadline) != ETIMEDOUT;
+}
+
+void portENTER_CRITICAL(portMUX_TYPE* mux) {
+    pthread_mutex_lock(&mux->mutex);
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE* mux) {
+    pthread_mutex_unlock(&mux->mutex);
+}
+
+/*
+ Queues.
+ */
+struct shim_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t  changed;
+    UBaseType_t     length;
+    UBaseType_t     item_size;
+    UBaseType_t     head;
+    UBaseType_t     count;
+    uint8_t*        items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    QueueHandle_t queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->items = malloc(length * item_size);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    cond_init(&queue->changed);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->changed);
+    free(queue->items);
+    free(queue);
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void* item, TickType_t ticks, bool front) {
+    UBaseType_t slot;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (!cond_wait_ticks(&queue->changed, &queue->mutex, ticks)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    if (front) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        slot = queue->head;
+    } else {
+        slot = (queue->head + queue->count) % queue->length;
+    }
+    memcpy(queue->items + slot * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queue_send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    return queue_send(queue, item, ticks, true);
+}
+
+static BaseType_t queue_receive(QueueHandle_t queue, void* item, TickType_t ticks, bool remove) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (!cond_wait_ticks(&queue->changed, &queue->mutex, ticks)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    if (remove) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+    return queue_receive(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t ticks) {
+    return queue_receive(queue, item, ticks, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->mutex);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* woken) {
+    if (woken != NULL) {
+        *woken = pdFALSE;
+    }
+    return queue_send(queue, item, 0, false);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void* item, BaseType_t* woken) {
+    if (woken != NULL) {
+        *woken = pdFALSE;
+    }
+    return queue_receive(queue, item, 0, true);
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t queue) {
+    return uxQueueMessagesWaiting(queue);
+}
+
+/*
+ Event groups.
+ */
+struct shim_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t  changed;
+    EventBits_t     bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    EventGroupHandle_t group = calloc(1, sizeof(*group));
+    if (group == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&group->mutex, NULL);
+    cond_init(&group->changed);
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    pthread_mutex_destroy(&group->mutex);
+    pthread_cond_destroy(&group->changed);
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t result;
+
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    result = group->bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t result;
+
+    pthread_mutex_lock(&group->mutex);
+    result = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    EventBits_t result;
+
+    pthread_mutex_lock(&group->mutex);
+    result = group->bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks) {
+    EventBits_t result;
+
+    pthread_mutex_lock(&group->mutex);
+    for (;;) {
+        EventBits_t set = group->bits & bits;
+        if (all ? set == bits : set != 0) {
+            break;
+        }
+        if (!cond_wait_ticks(&group->changed, &group->mutex, ticks)) {
+            break;
+        }
+    }
+    result = group->bits;
+    if (clear && (all ? (result & bits) == bits : (result & bits) != 0)) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+/*
+ esp_timer, one thread per timer.
+ */
+struct shim_timer {
+    pthread_mutex_t mutex;
+    pthread_cond_t  changed;
+    pthread_t       thread;
+    esp_timer_cb_t  callback;
+    void*           arg;
+    bool            armed;
+    struct timespec deadline;
+};
+
+int64_t esp_timer_get_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void* timer_thread(void* arg) {
+    esp_timer_handle_t timer = arg;
+
+    pthread_mutex_lock(&timer->mutex);
+    for (;;) {
+        if (!timer->armed) {
+            pthread_cond_wait(&timer->changed, &timer->mutex);
+        } else if (pthread_cond_timedwait(&timer->changed, &timer->mutex, &timer->deadline) == ETIMEDOUT) {
+            timer->armed = false;
+            pthread_mutex_unlock(&timer->mutex);
+            timer->callback(timer->arg);
+            pthread_mutex_lock(&timer->mutex);
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out) {
+    esp_timer_handle_t timer = calloc(1, sizeof(*timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_mutex_init(&timer->mutex, NULL);
+    cond_init(&timer->changed);
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    if (pthread_create(&timer->thread, NULL, timer_thread, timer) != 0) {
+        free(timer);
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_detach(timer->thread);
+    *out = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    esp_err_t res = ESP_OK;
+
+    pthread_mutex_lock(&timer->mutex);
+    if (timer->armed) {
+        res = ESP_ERR_INVALID_STATE;
+    } else {
+        timer->armed = true;
+        deadline_after(&timer->deadline, timeout_us);
+        pthread_cond_signal(&timer->changed);
+    }
+    pthread_mutex_unlock(&timer->mutex);
+    return res;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    esp_err_t res = ESP_OK;
+
+    pthread_mutex_lock(&timer->mutex);
+    if (!timer->armed) {
+        res = ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->mutex);
+    return res;
+}
+
+/*
+ ESP-NOW loopback.
+ */
+typedef struct radio_frame {
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    uint8_t length;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} radio_frame_t;
+
+static QueueHandle_t radio_queue;
+static pthread_t radio_task;
+static esp_now_recv_cb_t espnow_recv;
+static esp_now_send_cb_t espnow_send;
+static uint32_t radio_airtime_us;
+
+static void* radio_thread(void* arg) {
+    radio_frame_t frame;
+
+    for (;;) {
+        xQueueReceive(radio_queue, &frame, portMAX_DELAY);
+        if (radio_airtime_us != 0) {
+            struct timespec airtime = { 0, radio_airtime_us * 1000 };
+            nanosleep(&airtime, NULL);
+        }
+        espnow_send(frame.mac, ESP_NOW_SEND_SUCCESS);
+        espnow_recv(frame.mac, frame.data, frame.length);
+    }
+    return NULL;
+}
+
+void shim_radio_set_airtime(uint32_t airtime_us) {
+    radio_airtime_us = airtime_us;
+}
+
+esp_err_t esp_now_init(void) {
+    if (radio_queue == NULL) {
+        /* The driver queues a handful of frames for transmission, as does this. */
+        radio_queue = xQueueCreate(SHIM_RADIO_QUEUE_LENGTH, sizeof(radio_frame_t));
+        if (radio_queue == NULL || pthread_create(&radio_task, NULL, radio_thread, NULL) != 0) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+    espnow_recv = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) {
+    espnow_send = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t* mac, const uint8_t* data, size_t len) {
+    radio_frame_t frame;
+
+    if (mac == NULL || len == 0 || len > ESP_NOW_MAX_DATA_LEN) {
+        return ESP_ERR_ESPNOW_ARG;
+    }
+    memcpy(frame.mac, mac, ESP_NOW_ETH_ALEN);
+    frame.length = len;
+    memcpy(frame.data, data, len);
+    /* The real driver fails with ESP_ERR_ESPNOW_NO_MEM rather than blocking, the bench never fills it. */
+    return xQueueSend(radio_queue, &frame, portMAX_DELAY) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer) { return ESP_OK; }
+esp_err_t esp_now_mod_peer(const esp_now_peer_info_t* peer) { return ESP_OK; }
+esp_err_t esp_now_del_peer(const uint8_t* mac) { return ESP_OK; }
+bool esp_now_is_peer_exist(const uint8_t* mac) { return true; }
+esp_err_t esp_now_set_pmk(const uint8_t* pmk) { return ESP_OK; }
+
+/*
+ The rest of the driver.
+ */
+esp_err_t esp_wifi_init_internal(wifi_init_config_t* config) { return ESP_OK; }
+esp_err_t esp_wifi_deinit(void) { return ESP_OK; }
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) { return ESP_OK; }
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) { return ESP_OK; }
+esp_err_t esp_wifi_get_mode(wifi_mode_t* mode) { *mode = WIFI_MODE_STA; return ESP_OK; }
+esp_err_t esp_wifi_start(void) { return ESP_OK; }
+esp_err_t esp_wifi_stop(void) { return ESP_OK; }
+esp_err_t esp_wifi_connect(void) { return ESP_OK; }
+esp_err_t esp_wifi_disconnect(void) { return ESP_OK; }
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* config) { return ESP_OK; }
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t* config) { memset(config, 0, sizeof(*config)); return ESP_OK; }
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t* config, bool block) { return ESP_OK; }
+esp_err_t esp_wifi_scan_stop(void) { return ESP_OK; }
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t* number) { *number = 0; return ESP_OK; }
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t* number, wifi_ap_record_t* records) { *number = 0; return ESP_OK; }
+esp_err_t esp_wifi_get_mac(wifi_interface_t interface, uint8_t* mac) { memset(mac, 0, 6); mac[5] = interface; return ESP_OK; }
+esp_err_t esp_wifi_internal_reg_rxcb(wifi_interface_t interface, wifi_rxcb_t fn) { return ESP_OK; }
+void esp_wifi_internal_free_rx_buffer(void* eb) { }
+int esp_wifi_internal_tx(wifi_interface_t interface, void* buffer, uint16_t len) { return 0; }
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void* ctx) { return ESP_OK; }
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_open(const char* name, nvs_open_mode mode, nvs_handle* handle) { return ESP_FAIL; }
+void nvs_close(nvs_handle handle) { }
+esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out, size_t* length) { return ESP_FAIL; }
+esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length) { return ESP_FAIL; }
+esp_err_t nvs_erase_key(nvs_handle handle, const char* key) { return ESP_FAIL; }
+esp_err_t nvs_commit(nvs_handle handle) { return ESP_FAIL; }
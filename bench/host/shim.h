@@ -0,0 +1,12 @@
+#ifndef SHIM_H
+#define SHIM_H
+
+#include <stdint.h>
+
+/* Frames the loopback radio holds before esp_now_send blocks. */
+#define SHIM_RADIO_QUEUE_LENGTH 32
+
+/* Sleep this long per frame in the radio thread, 0 to loop back as fast as possible. */
+void shim_radio_set_airtime(uint32_t airtime_us);
+
+#endif
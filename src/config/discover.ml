@@ -0,0 +1,15 @@
+(* Prints the C flags selecting the roles compiled into the library (see WIFI_ENABLE_* in wifi.h),
+   from the WIFI_ESP32_VARIANT environment variable:
+   - full (default): station, access point, ESP-NOW, scanning and the AP/STA bridge
+   - sta: station, ESP-NOW and scanning
+   - ap: access point only *)
+
+let flags = function
+    | "full" -> []
+    | "sta" -> ["-DWIFI_ENABLE_AP=0"]
+    | "ap" -> ["-DWIFI_ENABLE_STA=0"]
+    | variant -> failwith ("Unknown WIFI_ESP32_VARIANT: " ^ variant)
+
+let () = 
+    let variant = try Sys.getenv "WIFI_ESP32_VARIANT" with Not_found -> "full" in
+    print_string ("(" ^ String.concat " " (flags variant) ^ ")")
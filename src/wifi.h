@@ -4,6 +4,26 @@
 #include "esp_system.h"
 #include "esp_event.h"
 
+/*
+ Roles compiled into the library. The build sets them from the WIFI_ESP32_VARIANT 
+ environment variable, see config/discover.ml.
+ */
+#ifndef WIFI_ENABLE_STA
+#define WIFI_ENABLE_STA     1
+#endif
+#ifndef WIFI_ENABLE_AP
+#define WIFI_ENABLE_AP      1
+#endif
+#ifndef WIFI_ENABLE_ESPNOW
+#define WIFI_ENABLE_ESPNOW  WIFI_ENABLE_STA
+#endif
+#ifndef WIFI_ENABLE_SCAN
+#define WIFI_ENABLE_SCAN    WIFI_ENABLE_STA
+#endif
+#ifndef WIFI_ENABLE_BRIDGE
+#define WIFI_ENABLE_BRIDGE  (WIFI_ENABLE_STA && WIFI_ENABLE_AP)
+#endif
+
 #define WIFI_ERR_OK     0
 #define WIFI_ERR_AGAIN  1
 #define WIFI_ERR_INVAL  2
@@ -18,6 +38,15 @@
 #define ESP_STA_DISCONNECTED_BIT    BIT5
 #define ESP_STA_FRAME_RECEIVED_BIT  BIT6
 #define ESP_AP_FRAME_RECEIVED_BIT   BIT7
+#define ESP_ESPNOW_FRAME_RECEIVED_BIT BIT8
+#define ESP_ESPNOW_SEND_DONE_BIT    BIT9
+#define ESP_LINK_EVENT_BIT          BIT10
+
+/*
+ Pseudo-interface routing ESP-NOW traffic through wifi_read/wifi_write.
+ Frames are laid out as the 6-byte peer MAC address followed by the payload.
+ */
+#define WIFI_IF_ESPNOW              ((wifi_interface_t) ESP_IF_MAX)
 
 typedef struct wifi_status {
     unsigned int wifi_inited    : 1;
@@ -26,6 +55,74 @@ typedef struct wifi_status {
     unsigned int sta_connected  : 1;
 } wifi_status;
 
+typedef struct wifi_espnow_stats {
+    uint32_t tx_success;
+    uint32_t tx_fail;
+    uint32_t tx_pending;
+    uint32_t rx_dropped;
+} wifi_espnow_stats;
+
+typedef enum {
+    WIFI_LINK_STA_START = 0,
+    WIFI_LINK_STA_STOP,
+    WIFI_LINK_STA_CONNECTED,
+    WIFI_LINK_STA_DISCONNECTED,
+    WIFI_LINK_AP_START,
+    WIFI_LINK_AP_STOP,
+    WIFI_LINK_AP_STACONNECTED,
+    WIFI_LINK_AP_STADISCONNECTED
+} wifi_link_event_kind;
+
+typedef struct wifi_link_event {
+    int64_t  timestamp_us;  /* esp_timer_get_time() when the event was handled. */
+    uint8_t  kind;          /* wifi_link_event_kind */
+    uint8_t  reason;        /* STA_DISCONNECTED: wifi_err_reason_t */
+    uint8_t  channel;       /* STA_CONNECTED */
+    uint8_t  aid;           /* AP_STACONNECTED, AP_STADISCONNECTED */
+    uint8_t  addr[6];       /* BSSID for station events, station MAC for AP events. */
+} wifi_link_event_t;
+
+typedef struct wifi_rx_stats {
+    uint32_t frames;    /* frames queued */
+    uint32_t wakeups;   /* times the frame received bit was set */
+} wifi_rx_stats;
+
+/*
+ Log2-bucketed latency histograms, in microseconds: bucket 0 counts samples under 1us 
+ and bucket i samples in [2^(i-1), 2^i). The last bucket also holds everything above.
+ */
+#define WIFI_HISTOGRAM_BUCKETS 32
+
+typedef struct wifi_histograms {
+    uint32_t dwell[WIFI_HISTOGRAM_BUCKETS]; /* rx callback enqueue -> wifi_read dequeue */
+    uint32_t tx[WIFI_HISTOGRAM_BUCKETS];    /* esp_wifi_internal_tx (esp_now_send) call duration in wifi_write */
+} wifi_histograms;
+
+typedef struct wifi_fast_join_stats {
+    int64_t  last_join_us;      /* from the first connection attempt to SYSTEM_EVENT_STA_CONNECTED, -1 if none */
+    bool     last_targeted;     /* the last join used the cached BSSID and channel */
+    uint32_t targeted_joins;
+    uint32_t fallbacks;         /* targeted joins that failed and fell back to a full scan */
+} wifi_fast_join_stats;
+
+typedef enum {
+    WIFI_BRIDGE_STA_TO_AP = 0,
+    WIFI_BRIDGE_AP_TO_STA
+} wifi_bridge_direction;
+
+typedef struct wifi_bridge_stats {
+    uint32_t forwarded[2];      /* indexed by wifi_bridge_direction */
+    uint32_t rate_limited[2];   /* dropped by the direction's rate limit */
+    uint32_t punted;            /* passed up to the stack */
+    uint32_t filtered;          /* dropped, destination learnt on the ingress side */
+    uint32_t tx_failed;         /* dropped, esp_wifi_internal_tx failed */
+} wifi_bridge_stats;
+
+typedef struct wifi_arp_stats {
+    uint32_t answered;          /* requests answered from the rx callback */
+    uint32_t passed_up;         /* requests queued for the stack, not counting those forwarded by the bridge */
+} wifi_arp_stats;
+
 esp_err_t wifi_initialize();
 esp_err_t wifi_deinitialize();
 
@@ -33,8 +130,52 @@ wifi_status wifi_get_status();
 void wifi_set_event_group(EventGroupHandle_t event_group, int offset);
 
 int wifi_read(wifi_interface_t interface, uint8_t* buf, size_t* size);
+/* Length of the next frame, WIFI_ERR_AGAIN if there is none. */
+int wifi_peek_length(wifi_interface_t interface, size_t* length);
+/* Reads the next frame across `count` buffers. If it does not fit, WIFI_ERR_INVAL is returned and the frame stays queued. */
+int wifi_read_chain(wifi_interface_t interface, uint8_t** bufs, const size_t* sizes, int count, size_t* length);
 int wifi_write(wifi_interface_t interface, uint8_t* buf, size_t* size);
 
 void wifi_wait_for_event(int event_bitset);
 
+/* Station configuration and connection, going through the fast join cache. */
+esp_err_t wifi_sta_set_config(const wifi_sta_config_t* config);
+esp_err_t wifi_sta_connect();
+void wifi_fast_join_configure(bool enabled, bool persistent);
+void wifi_fast_join_forget();
+wifi_fast_join_stats wifi_fast_join_get_stats();
+
+/* Signal frame reception once `max_frames` are pending or `max_delay_us` after the first one. */
+int wifi_set_rx_coalescing(uint32_t max_frames, uint32_t max_delay_us);
+wifi_rx_stats wifi_get_rx_stats(wifi_interface_t interface);
+/* Copies the interface histograms to `out`, then clears them if `reset`. Same task as wifi_read/wifi_write only. */
+int wifi_get_histograms(wifi_interface_t interface, wifi_histograms* out, bool reset);
+
+/* Pops up to `max` link events in order. ESP_LINK_EVENT_BIT is set while some are pending. */
+int wifi_link_events_drain(wifi_link_event_t* events, int max);
+/* Number of events dropped because the queue was full. */
+uint32_t wifi_link_events_overflow();
+
+esp_err_t wifi_espnow_start();
+esp_err_t wifi_espnow_stop();
+esp_err_t wifi_espnow_set_pmk(const uint8_t* pmk);
+/* `lmk` is NULL for an unencrypted peer. */
+esp_err_t wifi_espnow_add_peer(const uint8_t* mac, uint8_t channel, wifi_interface_t interface, const uint8_t* lmk);
+esp_err_t wifi_espnow_del_peer(const uint8_t* mac);
+wifi_espnow_stats wifi_espnow_get_stats();
+
+/* ARP requests for a registered (interface, IPv4) binding are answered from the rx callback. */
+void wifi_arp_set_enabled(bool enabled);
+int wifi_arp_add_binding(wifi_interface_t interface, const uint8_t* ip, const uint8_t* mac);
+int wifi_arp_remove_binding(wifi_interface_t interface, const uint8_t* ip);
+wifi_arp_stats wifi_arp_get_stats();
+
+/* L2 bridge between the AP and STA interfaces, forwarding from the rx callbacks. 
+   AP clients are translated behind the STA MAC address, for IPv4 and ARP only. */
+esp_err_t wifi_bridge_set_enabled(bool enabled);
+void wifi_bridge_set_aging(uint32_t aging_s);
+/* At most `frames_per_s` frames per second with bursts of `burst` frames, 0 for no limit. */
+void wifi_bridge_set_rate_limit(wifi_bridge_direction direction, uint32_t frames_per_s, uint32_t burst);
+wifi_bridge_stats wifi_bridge_get_stats();
+
 #endif
\ No newline at end of file
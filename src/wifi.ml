@@ -2,7 +2,8 @@
 type wifi_mode = MODE_STA | MODE_AP | MODE_APSTA
 
 (* Wifi interface *)
-type wifi_interface = IF_STA | IF_AP
+(* IF_ESPNOW frames are the 6-byte peer MAC address followed by the payload *)
+type wifi_interface = IF_STA | IF_AP | IF_ESPNOW
 
 type wifi_auth_mode = 
     | AUTH_OPEN
@@ -49,6 +50,9 @@ type wifi_event =
     | STA_disconnected
     | STA_frame_received
     | AP_frame_received
+    | ESPNOW_frame_received
+    | ESPNOW_send_done
+    | Link_event
 
 type wifi_sta_description = {
     mac: Bytes.t;
@@ -60,6 +64,86 @@ type wifi_ap_description = {
     auth_mode: wifi_auth_mode;
 }
 
+type espnow_peer = {
+    peer_mac: Bytes.t;
+    peer_channel: int;
+    peer_interface: wifi_interface;
+    peer_lmk: Bytes.t option;
+}
+
+type espnow_stats = {
+    tx_success: int;
+    tx_fail: int;
+    tx_pending: int;
+    rx_dropped: int;
+}
+
+type arp_stats = {
+    arp_answered: int;
+    arp_passed_up: int;
+}
+
+type rx_stats = {
+    rx_frames: int;
+    rx_wakeups: int;
+}
+
+(* Bucket 0 counts samples under 1us, bucket i samples of [2^(i-1), 2^i) microseconds. *)
+type histograms = {
+    (* rx callback to [read] *)
+    hist_dwell: int array;
+    (* time spent handing a frame to the driver in [write] *)
+    hist_tx: int array;
+}
+
+type fast_join_stats = {
+    (* From the first connection attempt to association, -1L if none yet *)
+    join_time_us: int64;
+    (* Whether the last join used the cached BSSID and channel *)
+    join_targeted: bool;
+    targeted_joins: int;
+    (* Targeted joins that failed and fell back to a full scan *)
+    join_fallbacks: int;
+}
+
+type bridge_direction = STA_to_AP | AP_to_STA
+
+type bridge_stats = {
+    sta_to_ap_forwarded: int;
+    ap_to_sta_forwarded: int;
+    sta_to_ap_rate_limited: int;
+    ap_to_sta_rate_limited: int;
+    (* Frames passed up to [read]: addressed to us, broadcast or multicast *)
+    bridge_punted: int;
+    (* Frames dropped because their destination was learnt on the ingress side *)
+    bridge_filtered: int;
+    (* Frames dropped because the driver refused to send them *)
+    bridge_tx_failed: int;
+}
+
+type link_event_kind = 
+    | Link_STA_started
+    | Link_STA_stopped
+    | Link_STA_connected
+    | Link_STA_disconnected
+    | Link_AP_started
+    | Link_AP_stopped
+    | Link_AP_STA_connected
+    | Link_AP_STA_disconnected
+
+type link_event = {
+    link_timestamp_us: int64;
+    link_kind: link_event_kind;
+    (* Disconnection reason code, for Link_STA_disconnected *)
+    link_reason: int;
+    (* for Link_STA_connected *)
+    link_channel: int;
+    (* Association id, for Link_AP_STA_connected/disconnected *)
+    link_aid: int;
+    (* BSSID for station events, station MAC address for AP events *)
+    link_addr: Bytes.t;
+}
+
 let id_of_event = function 
     | STA_started -> 0 
     | STA_stopped -> 1 
@@ -69,8 +153,26 @@ let id_of_event = function
     | STA_disconnected -> 5 
     | STA_frame_received -> 6 
     | AP_frame_received -> 7
+    | ESPNOW_frame_received -> 8
+    | ESPNOW_send_done -> 9
+    | Link_event -> 10
 
-external get_status : unit -> wifi_status = "ml_wifi_get_status"
+(* Status as a bitset, see the [status_*] masks. Does not allocate. *)
+external get_status_bits : unit -> (int [@untagged]) = 
+    "ml_wifi_get_status_byte" "ml_wifi_get_status_untagged" [@@noalloc]
+
+let status_inited = 1
+let status_ap_started = 2
+let status_sta_started = 4
+let status_sta_connected = 8
+
+let get_status () = 
+    let bits = get_status_bits () in {
+        inited = bits land status_inited <> 0;
+        ap_started = bits land status_ap_started <> 0;
+        sta_started = bits land status_sta_started <> 0;
+        sta_connected = bits land status_sta_connected <> 0;
+    }
 
 external initialize : unit -> (unit, wifi_error) result = "ml_wifi_initialize"
 external deinitialize : unit -> (unit, wifi_error) result = "ml_wifi_deinitialize"
@@ -90,6 +192,18 @@ external sta_get_config : unit -> (wifi_configuration_sta, wifi_error) result =
 external connect : unit -> (unit, wifi_error) result = "ml_wifi_connect"
 external disconnect : unit -> (unit, wifi_error) result = "ml_wifi_disconnect"
 
+(* Fast join: [sta_set_config] targets the BSSID and channel of the last association with the same SSID,
+   falling back to a full scan if that fails. [fast_join_configure enabled persistent], persistent 
+   keeps the cache in NVS across reboots. Enabled, in RAM only, by default. Call it before [sta_set_config]
+   for the first join to use a persisted cache, otherwise it is used from the next reconnection. *)
+external fast_join_configure : bool -> bool -> unit = "ml_wifi_fast_join_configure" [@@noalloc]
+external fast_join_forget : unit -> unit = "ml_wifi_fast_join_forget"
+external fast_join_get_stats : unit -> fast_join_stats = "ml_wifi_fast_join_get_stats"
+
+(* Link events, oldest first. Link_event is signalled while some are pending. *)
+external link_events_drain : unit -> link_event array = "ml_wifi_link_events_drain"
+external link_events_overflow : unit -> int = "ml_wifi_link_events_overflow" [@@noalloc]
+
 (* Scanning functions *)
 
 external scan_start : unit -> (unit, wifi_error) result = "ml_wifi_scan_start"
@@ -99,8 +213,56 @@ external scan_get_array : int -> (wifi_ap_description array, wifi_error) result
 
 (* Network interface functions *)
 
-external read : wifi_interface -> Cstruct.buffer -> int -> (int, wifi_error) result = "ml_wifi_read"
-external write : wifi_interface -> Cstruct.buffer -> int -> (unit, wifi_error) result = "ml_wifi_write"
+(* Allocation-free per-frame calls: [read_raw] returns the frame length and [write_raw] 0 on success, 
+   both return a negative error code (see [error_of_code]) on failure. *)
+external read_raw : wifi_interface -> Cstruct.buffer -> (int [@untagged]) -> (int [@untagged]) = 
+    "ml_wifi_read_byte" "ml_wifi_read_untagged" [@@noalloc]
+external write_raw : wifi_interface -> Cstruct.buffer -> (int [@untagged]) -> (int [@untagged]) = 
+    "ml_wifi_write_byte" "ml_wifi_write_untagged" [@@noalloc]
+
+(* Length of the next frame on the interface, or a negative error code if there is none. *)
+external peek_length_raw : wifi_interface -> (int [@untagged]) = 
+    "ml_wifi_peek_length_byte" "ml_wifi_peek_length_untagged" [@@noalloc]
+(* Reads the next frame across up to 8 buffers and returns its length. If the frame does not fit, 
+   nothing is read and the frame stays queued. *)
+external read_chain_raw : wifi_interface -> Cstruct.t list -> (int [@untagged]) = 
+    "ml_wifi_read_chain_byte" "ml_wifi_read_chain_untagged" [@@noalloc]
+
+(* Mirrors WIFI_ERR_* in wifi.h *)
+let error_of_code = function
+    | -1 -> Nothing_to_read
+    | -2 -> Invalid_argument
+    | _ -> Unspecified
+
+(* Same as [Error (error_of_code n)], but the results are constants so failed calls do not allocate. 
+   Of the wrappers below, only a successful [read], [peek_length] or [read_chain] allocates, its [Ok n]. *)
+let error_result_of_code = function
+    | -1 -> Error Nothing_to_read
+    | -2 -> Error Invalid_argument
+    | _ -> Error Unspecified
+
+let read intf buf len = 
+    let n = read_raw intf buf len in 
+    if n >= 0 then Ok n else error_result_of_code n
+
+let peek_length intf = 
+    let n = peek_length_raw intf in 
+    if n >= 0 then Ok n else error_result_of_code n
+
+let read_chain intf bufs = 
+    let n = read_chain_raw intf bufs in 
+    if n >= 0 then Ok n else error_result_of_code n
+
+let write intf buf len = 
+    let n = write_raw intf buf len in 
+    if n >= 0 then Ok () else error_result_of_code n
+
+(* [set_rx_coalescing max_frames max_delay_us] signals STA/AP/ESPNOW_frame_received once [max_frames] 
+   frames are pending or [max_delay_us] after the first of them. Default: 1 frame, no delay. *)
+external set_rx_coalescing : int -> int -> (unit, wifi_error) result = "ml_wifi_set_rx_coalescing"
+external get_rx_stats : wifi_interface -> rx_stats = "ml_wifi_get_rx_stats"
+(* [get_histograms intf reset] snapshots the latency histograms of [intf], clearing them if [reset]. *)
+external get_histograms : wifi_interface -> bool -> (histograms, wifi_error) result = "ml_wifi_get_histograms"
 external internal_get_mac : wifi_interface -> (string, wifi_error) result = "ml_wifi_get_mac"
 let get_mac intf = 
     match internal_get_mac intf with 
@@ -108,3 +270,30 @@ let get_mac intf =
         | Error _ -> failwith "Wifi.internal_get_mac"
     
 
+(* ESP-NOW functions *)
+
+external espnow_start : unit -> (unit, wifi_error) result = "ml_wifi_espnow_start"
+external espnow_stop : unit -> (unit, wifi_error) result = "ml_wifi_espnow_stop"
+external espnow_set_pmk : Bytes.t -> (unit, wifi_error) result = "ml_wifi_espnow_set_pmk"
+external espnow_add_peer : espnow_peer -> (unit, wifi_error) result = "ml_wifi_espnow_add_peer"
+external espnow_del_peer : Bytes.t -> (unit, wifi_error) result = "ml_wifi_espnow_del_peer"
+external espnow_get_stats : unit -> espnow_stats = "ml_wifi_espnow_get_stats"
+
+(* ARP responder: requests for a registered (interface, IPv4 address, MAC address) 
+   binding are answered in C and never reach [read]. *)
+
+external arp_set_enabled : bool -> unit = "ml_wifi_arp_set_enabled" [@@noalloc]
+external arp_add_binding : wifi_interface -> Bytes.t -> Bytes.t -> (unit, wifi_error) result = "ml_wifi_arp_add_binding"
+external arp_remove_binding : wifi_interface -> Bytes.t -> (unit, wifi_error) result = "ml_wifi_arp_remove_binding"
+external arp_get_stats : unit -> arp_stats = "ml_wifi_arp_get_stats"
+
+(* L2 bridge between IF_AP and IF_STA in MODE_APSTA, forwarding in C frames not addressed to us. 
+   The station link is 3-address, so AP clients are translated behind the STA MAC address: their
+   IPv4 addresses are learnt from ARP, IPv4 and DHCP to route replies back. Other protocols (IPv6)
+   are only bridged when group-addressed. Addresses age out after 300s by default. *)
+
+external bridge_set_enabled : bool -> (unit, wifi_error) result = "ml_wifi_bridge_set_enabled"
+external bridge_set_aging : int -> unit = "ml_wifi_bridge_set_aging" [@@noalloc]
+(* [bridge_set_rate_limit direction frames_per_s burst], 0 frames per second for no limit *)
+external bridge_set_rate_limit : bridge_direction -> int -> int -> unit = "ml_wifi_bridge_set_rate_limit" [@@noalloc]
+external bridge_get_stats : unit -> bridge_stats = "ml_wifi_bridge_get_stats"
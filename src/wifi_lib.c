@@ -15,8 +15,11 @@
 #include "esp_event.h"
 #include "esp_event_loop.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "driver/gpio.h"
 #include "esp_wifi_internal.h"
+#include "esp_now.h"
+#include "esp_timer.h"
 
 #include "freertos/event_groups.h"
 
@@ -34,6 +37,8 @@ static wifi_status wifi_current_status = {
     .sta_connected   = 0
 };
 
+static void rx_queue_resignal(void);
+
 void wifi_set_event_group(EventGroupHandle_t event_group, int offset) {
     esp_event_group = event_group;
     esp_event_offset = offset;
@@ -41,6 +46,269 @@ void wifi_set_event_group(EventGroupHandle_t event_group, int offset) {
     xEventGroupSetBits(esp_event_group, ESP_STA_STOPPED_BIT << esp_event_offset);
     xEventGroupSetBits(esp_event_group, ESP_STA_DISCONNECTED_BIT << esp_event_offset);
     xEventGroupSetBits(esp_event_group, ESP_AP_STOPPED_BIT << esp_event_offset);
+
+    /* Queues signalled while there was no group, or on the previous one, would otherwise never wake the reader. */
+    rx_queue_resignal();
+}
+
+/*
+ Wifi frame descriptors storage. 
+ */
+typedef struct frame_list {
+    uint16_t length;
+    void* buffer;
+    void* l2_frame; /* the whole frame, to free with `esp_wifi_internal_free_rx_buffer` after transmmission to the stack. 
+                       NULL when `buffer` was allocated by us (ESP-NOW) and must be released with `free`. */
+    uint32_t enqueued_us;   /* low 32 bits of esp_timer_get_time() when queued. */
+} wifi_frame_t;
+
+/*
+ Per-interface receive queue and the event bit signalling it is non-empty.
+ */
+typedef struct wifi_rx_queue {
+    QueueHandle_t frames;
+    EventBits_t   received_bit;
+    const char*   name;
+    /* Notification coalescing state, protected by `rx_lock`. */
+    bool               signalled;   /* received_bit set since the queue was last emptied */
+    uint32_t           unsignalled; /* frames queued while not signalled */
+    esp_timer_handle_t flush_timer;
+    wifi_rx_stats      stats;
+    /* Only touched from the reader/writer task. */
+    wifi_histograms    histograms;
+} wifi_rx_queue_t;
+
+#if WIFI_ENABLE_STA
+static wifi_rx_queue_t sta_rx = {
+    .received_bit = ESP_STA_FRAME_RECEIVED_BIT,
+    .name         = "STA"
+};
+#endif
+
+#if WIFI_ENABLE_AP
+static wifi_rx_queue_t ap_rx = {
+    .received_bit = ESP_AP_FRAME_RECEIVED_BIT,
+    .name         = "AP"
+};
+#endif
+
+#if WIFI_ENABLE_ESPNOW
+static wifi_rx_queue_t espnow_rx = {
+    .received_bit = ESP_ESPNOW_FRAME_RECEIVED_BIT,
+    .name         = "ESP-NOW"
+};
+#endif
+
+static const MAX_NUMBER_OF_FRAMES = 20;
+
+/*
+ NULL for interfaces that are not compiled in.
+ */
+static wifi_rx_queue_t* rx_queue_of(wifi_interface_t interface) {
+#if WIFI_ENABLE_STA
+    if (interface == WIFI_IF_STA) {
+        return &sta_rx;
+    }
+#endif
+#if WIFI_ENABLE_AP
+    if (interface == WIFI_IF_AP) {
+        return &ap_rx;
+    }
+#endif
+#if WIFI_ENABLE_ESPNOW
+    if (interface == WIFI_IF_ESPNOW) {
+        return &espnow_rx;
+    }
+#endif
+    return NULL;
+}
+
+/*
+ Frame received notification coalescing.
+ The received bit is set once `rx_coalesce_frames` frames are pending, or `rx_coalesce_delay_us` 
+ after the first of them, whichever comes first. It then stays set until the reader empties the queue.
+ The default (1 frame) signals on the empty to non-empty transition only.
+ */
+static portMUX_TYPE rx_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t rx_coalesce_frames = 1;
+static uint32_t rx_coalesce_delay_us = 0;
+
+static void rx_queue_signal(wifi_rx_queue_t* rx) {
+    if (esp_event_group != NULL) {
+        xEventGroupSetBits(esp_event_group, rx->received_bit << esp_event_offset);
+    }
+}
+
+/*
+ Set the received bit again for every queue currently signalled, when the event group changes.
+ At worst this wakes the reader once on a queue it has just emptied.
+ */
+static void rx_queue_resignal(void) {
+    wifi_rx_queue_t* queues[] = {
+#if WIFI_ENABLE_STA
+        &sta_rx,
+#endif
+#if WIFI_ENABLE_AP
+        &ap_rx,
+#endif
+#if WIFI_ENABLE_ESPNOW
+        &espnow_rx,
+#endif
+    };
+
+    for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); i++) {
+        portENTER_CRITICAL(&rx_lock);
+        bool signalled = queues[i]->signalled;
+        portEXIT_CRITICAL(&rx_lock);
+
+        if (signalled) {
+            rx_queue_signal(queues[i]);
+        }
+    }
+}
+
+/*
+ Account for `added` newly pending frames, `received` of which have just been queued, 
+ signalling the reader if the coalescing thresholds are reached.
+ */
+static void rx_queue_notify(wifi_rx_queue_t* rx, uint32_t added, uint32_t received) {
+    bool signal = false;
+    bool arm = false;
+
+    portENTER_CRITICAL(&rx_lock);
+    rx->stats.frames += received;
+    if (!rx->signalled) {
+        arm = rx->unsignalled == 0;
+        rx->unsignalled += added;
+        if (rx->unsignalled >= rx_coalesce_frames) {
+            rx->signalled = true;
+            rx->unsignalled = 0;
+            rx->stats.wakeups++;
+            signal = true;
+        }
+    }
+    portEXIT_CRITICAL(&rx_lock);
+
+    if (signal) {
+        rx_queue_signal(rx);
+    } else if (arm) {
+        /* If a timer from a previous batch is still running this fails, and that batch's deadline flushes this one early. */
+        esp_timer_start_once(rx->flush_timer, rx_coalesce_delay_us);
+    }
+}
+
+static void rx_queue_flush_timeout(void* arg) {
+    wifi_rx_queue_t* rx = arg;
+    bool signal = false;
+
+    portENTER_CRITICAL(&rx_lock);
+    if (!rx->signalled && rx->unsignalled > 0) {
+        rx->signalled = true;
+        rx->unsignalled = 0;
+        rx->stats.wakeups++;
+        signal = true;
+    }
+    portEXIT_CRITICAL(&rx_lock);
+
+    if (signal) {
+        rx_queue_signal(rx);
+    }
+}
+
+/*
+ Called by the reader once the queue is empty.
+ */
+static void rx_queue_rearm(wifi_rx_queue_t* rx) {
+    /* Clear the bit before resetting the state: a frame notified in between sees `signalled` 
+       still set and is caught by the recheck below, instead of having its bit wiped. */
+    if (esp_event_group != NULL) {
+        xEventGroupClearBits(esp_event_group, rx->received_bit << esp_event_offset);
+    }
+
+    portENTER_CRITICAL(&rx_lock);
+    rx->signalled = false;
+    rx->unsignalled = 0;
+    portEXIT_CRITICAL(&rx_lock);
+
+    /* A frame may have been queued in between. */
+    UBaseType_t pending = uxQueueMessagesWaiting(rx->frames);
+    if (pending >= 1) {
+        rx_queue_notify(rx, pending, 0);
+    }
+}
+
+static esp_err_t rx_queue_init(wifi_rx_queue_t* rx) {
+    esp_timer_create_args_t timer_args = {
+        .callback = rx_queue_flush_timeout,
+        .arg      = rx,
+        .name     = rx->name
+    };
+
+    rx->frames = xQueueCreate(MAX_NUMBER_OF_FRAMES, sizeof(wifi_frame_t));
+    if (rx->frames == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    return esp_timer_create(&timer_args, &rx->flush_timer);
+}
+
+int wifi_set_rx_coalescing(uint32_t max_frames, uint32_t max_delay_us) {
+    /* Batches need a deadline, and must fit in the queues. */
+    if (max_frames == 0 || max_frames > MAX_NUMBER_OF_FRAMES || (max_frames > 1 && max_delay_us == 0)) {
+        return WIFI_ERR_INVAL;
+    }
+    portENTER_CRITICAL(&rx_lock);
+    rx_coalesce_frames = max_frames;
+    rx_coalesce_delay_us = max_delay_us;
+    portEXIT_CRITICAL(&rx_lock);
+    return WIFI_ERR_OK;
+}
+
+wifi_rx_stats wifi_get_rx_stats(wifi_interface_t interface) {
+    wifi_rx_stats st = { .frames = 0, .wakeups = 0 };
+    wifi_rx_queue_t* rx = rx_queue_of(interface);
+
+    if (rx != NULL) {
+        portENTER_CRITICAL(&rx_lock);
+        st = rx->stats;
+        portEXIT_CRITICAL(&rx_lock);
+    }
+    return st;
+}
+
+/*
+ Timestamps come from esp_timer rather than the CPU cycle counter: the rx callback and the reader 
+ usually run on different cores, whose cycle counters are not synchronised.
+ */
+static inline uint32_t histogram_now_us() {
+    return (uint32_t) esp_timer_get_time();
+}
+
+static inline void histogram_add(uint32_t* histogram, uint32_t us) {
+    int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    if (bucket >= WIFI_HISTOGRAM_BUCKETS) {
+        bucket = WIFI_HISTOGRAM_BUCKETS - 1;
+    }
+    histogram[bucket]++;
+}
+
+int wifi_get_histograms(wifi_interface_t interface, wifi_histograms* out, bool reset) {
+    wifi_rx_queue_t* rx = rx_queue_of(interface);
+    if (rx == NULL) {
+        return WIFI_ERR_INVAL;
+    }
+    *out = rx->histograms;
+    if (reset) {
+        memset(&rx->histograms, 0, sizeof(rx->histograms));
+    }
+    return WIFI_ERR_OK;
+}
+
+static void rx_frame_free(wifi_frame_t* frame) {
+    if (frame->l2_frame != NULL) {
+        esp_wifi_internal_free_rx_buffer(frame->l2_frame);
+    } else {
+        free(frame->buffer);
+    }
 }
 
 static uint32_t n_sta_frames = 0;
@@ -83,12 +351,275 @@ wifi_status wifi_get_status() {
     return wifi_current_status;
 }
 
+/*
+ Link events log, so that fast state changes and their payloads are not lost in the event group levels.
+ */
+#define MAX_NUMBER_OF_LINK_EVENTS 32
+
+static QueueHandle_t link_events;
+static uint32_t link_events_overflow = 0;
+
+static void link_event_push(wifi_link_event_kind kind, system_event_t *event) {
+    wifi_link_event_t tmp_event;
+
+    if (link_events == NULL) {
+        return;
+    }
+
+    memset(&tmp_event, 0, sizeof(tmp_event));
+    tmp_event.timestamp_us = esp_timer_get_time();
+    tmp_event.kind = kind;
+    switch (kind) {
+        case WIFI_LINK_STA_CONNECTED:
+            memcpy(tmp_event.addr, event->event_info.connected.bssid, 6);
+            tmp_event.channel = event->event_info.connected.channel;
+            break;
+        case WIFI_LINK_STA_DISCONNECTED:
+            memcpy(tmp_event.addr, event->event_info.disconnected.bssid, 6);
+            tmp_event.reason = event->event_info.disconnected.reason;
+            break;
+        case WIFI_LINK_AP_STACONNECTED:
+            memcpy(tmp_event.addr, event->event_info.sta_connected.mac, 6);
+            tmp_event.aid = event->event_info.sta_connected.aid;
+            break;
+        case WIFI_LINK_AP_STADISCONNECTED:
+            memcpy(tmp_event.addr, event->event_info.sta_disconnected.mac, 6);
+            tmp_event.aid = event->event_info.sta_disconnected.aid;
+            break;
+        default:
+            break;
+    }
+
+    /* Keep the most recent history: drop the oldest event. */
+    if (xQueueSend(link_events, &tmp_event, 0) != pdTRUE) {
+        wifi_link_event_t dropped;
+        xQueueReceive(link_events, &dropped, 0);
+        link_events_overflow++;
+        xQueueSend(link_events, &tmp_event, 0);
+    }
+    if (esp_event_group != NULL) {
+        xEventGroupSetBits(esp_event_group, ESP_LINK_EVENT_BIT << esp_event_offset);
+    }
+}
+
+int wifi_link_events_drain(wifi_link_event_t* events, int max) {
+    int n = 0;
+
+    if (link_events == NULL) {
+        return 0;
+    }
+
+    while (n < max && xQueueReceive(link_events, &events[n], 0)) {
+        n++;
+    }
+
+    if (uxQueueMessagesWaiting(link_events) == 0 && esp_event_group != NULL) {
+        xEventGroupClearBits(esp_event_group, ESP_LINK_EVENT_BIT << esp_event_offset);
+        if (uxQueueMessagesWaiting(link_events) >= 1) {
+            xEventGroupSetBits(esp_event_group, ESP_LINK_EVENT_BIT << esp_event_offset);
+        }
+    }
+    return n;
+}
+
+uint32_t wifi_link_events_overflow() {
+    return link_events_overflow;
+}
+
+#if WIFI_ENABLE_STA
+/*
+ Fast join cache.
+ The BSSID and channel of the last successful association are remembered (in RAM, and optionally in NVS)
+ and used to join the same AP without a full scan. If that fails, the configuration is reapplied 
+ without them and the next attempt scans as usual.
+ */
+#define FAST_JOIN_NVS_NAMESPACE "wifi_ml"
+#define FAST_JOIN_NVS_KEY       "fast_join"
+
+typedef struct fast_join_cache {
+    bool    valid;
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+} fast_join_cache_t;
+
+static bool fast_join_enabled = true;
+static bool fast_join_persistent = false;
+static bool fast_join_loaded = false;
+static fast_join_cache_t fast_join_cache;
+static wifi_sta_config_t sta_user_config;
+static bool fast_join_targeted = false;
+static bool fast_join_dirty = false;  /* the cache changed since the configuration was last applied */
+static int64_t join_started_us = -1;
+static wifi_fast_join_stats fast_join_stats = {
+    .last_join_us    = -1,
+    .last_targeted   = false,
+    .targeted_joins  = 0,
+    .fallbacks       = 0
+};
+
+static void fast_join_load() {
+    nvs_handle handle;
+    size_t size = sizeof(fast_join_cache);
+
+    fast_join_loaded = true;
+    if (nvs_open(FAST_JOIN_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(handle, FAST_JOIN_NVS_KEY, &fast_join_cache, &size) != ESP_OK 
+        || size != sizeof(fast_join_cache)) {
+        fast_join_cache.valid = false;
+    }
+    nvs_close(handle);
+}
+
+static void fast_join_store() {
+    nvs_handle handle;
+
+    if (!fast_join_persistent || nvs_open(FAST_JOIN_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (fast_join_cache.valid) {
+        nvs_set_blob(handle, FAST_JOIN_NVS_KEY, &fast_join_cache, sizeof(fast_join_cache));
+    } else {
+        nvs_erase_key(handle, FAST_JOIN_NVS_KEY);
+    }
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+/*
+ Apply the user station configuration, targeted at the cached AP if it matches.
+ */
+static esp_err_t fast_join_apply() {
+    wifi_config_t esp_config = {
+        .sta = sta_user_config
+    };
+
+    fast_join_dirty = false;
+    fast_join_targeted = fast_join_enabled 
+        && fast_join_cache.valid
+        && memcmp(fast_join_cache.ssid, sta_user_config.ssid, sizeof(fast_join_cache.ssid)) == 0;
+    if (fast_join_targeted) {
+        esp_config.sta.bssid_set = true;
+        memcpy(esp_config.sta.bssid, fast_join_cache.bssid, sizeof(fast_join_cache.bssid));
+        esp_config.sta.channel = fast_join_cache.channel;
+    }
+    return esp_wifi_set_config(WIFI_IF_STA, &esp_config);
+}
+
+static void fast_join_on_connected(system_event_sta_connected_t* info) {
+    if (join_started_us >= 0) {
+        fast_join_stats.last_join_us = esp_timer_get_time() - join_started_us;
+        join_started_us = -1;
+    }
+    fast_join_stats.last_targeted = fast_join_targeted;
+    if (fast_join_targeted) {
+        fast_join_stats.targeted_joins++;
+    }
+
+    if (!fast_join_enabled) {
+        return;
+    }
+    fast_join_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    cache.valid = true;
+    memcpy(cache.ssid, info->ssid, info->ssid_len < sizeof(cache.ssid) ? info->ssid_len : sizeof(cache.ssid));
+    memcpy(cache.bssid, info->bssid, sizeof(cache.bssid));
+    cache.channel = info->channel;
+    if (memcmp(&cache, &fast_join_cache, sizeof(cache)) != 0) {
+        fast_join_cache = cache;
+        fast_join_dirty = true;
+        fast_join_store();
+    }
+}
+
+/*
+ Called before reconnecting. Changing the station configuration while associated would drop the link, 
+ so the cache is only applied here.
+ */
+static void fast_join_on_disconnected(bool was_connected) {
+    if (!was_connected && fast_join_targeted) {
+        fast_join_stats.fallbacks++;
+        fast_join_cache.valid = false;
+        fast_join_store();
+        fast_join_apply();
+    } else if (fast_join_dirty) {
+        fast_join_apply();
+    }
+}
+
+void wifi_fast_join_configure(bool enabled, bool persistent) {
+    fast_join_enabled = enabled;
+    fast_join_persistent = persistent;
+    fast_join_dirty = true;
+    /* Possibly after wifi_sta_set_config: the cache is then applied at the next reconnection. */
+    if (persistent && !fast_join_loaded) {
+        if (fast_join_cache.valid) {
+            /* Already learnt in this session, more recent than the stored one. */
+            fast_join_loaded = true;
+            fast_join_store();
+        } else {
+            fast_join_load();
+        }
+    }
+}
+
+void wifi_fast_join_forget() {
+    fast_join_cache.valid = false;
+    fast_join_dirty = true;
+    fast_join_store();
+}
+
+wifi_fast_join_stats wifi_fast_join_get_stats() {
+    return fast_join_stats;
+}
+
+esp_err_t wifi_sta_set_config(const wifi_sta_config_t* config) {
+    sta_user_config = *config;
+    sta_user_config.bssid_set = false;
+    sta_user_config.channel = 0;
+    if (fast_join_persistent && !fast_join_loaded) {
+        fast_join_load();
+    }
+    return fast_join_apply();
+}
+
+esp_err_t wifi_sta_connect() {
+    if (join_started_us < 0 && !wifi_current_status.sta_connected) {
+        join_started_us = esp_timer_get_time();
+    }
+    return esp_wifi_connect();
+}
+#else
+esp_err_t wifi_sta_set_config(const wifi_sta_config_t* config) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t wifi_sta_connect() {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void wifi_fast_join_configure(bool enabled, bool persistent) {
+}
+
+void wifi_fast_join_forget() {
+}
+
+wifi_fast_join_stats wifi_fast_join_get_stats() {
+    wifi_fast_join_stats st = { .last_join_us = -1 };
+    return st;
+}
+#endif
+
 esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
 {
     printf("Wifi event: %d\n", event->event_id);
     switch(event->event_id) {
+#if WIFI_ENABLE_STA
         /* Station events */
         case SYSTEM_EVENT_STA_START:
+            link_event_push(WIFI_LINK_STA_START, event);
             ESP_ERROR_CHECK(esp_wifi_internal_reg_rxcb(WIFI_IF_STA, sta_packet_handler));
             wifi_current_status.sta_started = true;
             if (esp_event_group != NULL) {
@@ -97,6 +628,7 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
             }
             break;
         case SYSTEM_EVENT_STA_STOP:
+            link_event_push(WIFI_LINK_STA_STOP, event);
             wifi_current_status.sta_started = false;
             if (esp_event_group != NULL) {
                 xEventGroupClearBits(esp_event_group, ESP_STA_STARTED_BIT << esp_event_offset);
@@ -104,22 +636,29 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
             }
             break;
         case SYSTEM_EVENT_STA_CONNECTED:
+            link_event_push(WIFI_LINK_STA_CONNECTED, event);
             wifi_current_status.sta_connected = true;
+            fast_join_on_connected(&event->event_info.connected);
             if (esp_event_group != NULL) {
                 xEventGroupSetBits(esp_event_group, ESP_STA_CONNECTED_BIT << esp_event_offset);
                 xEventGroupClearBits(esp_event_group, ESP_STA_DISCONNECTED_BIT << esp_event_offset);
             }
             break;
         case SYSTEM_EVENT_STA_DISCONNECTED:
+            link_event_push(WIFI_LINK_STA_DISCONNECTED, event);
+            fast_join_on_disconnected(wifi_current_status.sta_connected);
             wifi_current_status.sta_connected = false;
-            esp_wifi_connect();
+            wifi_sta_connect();
             if (esp_event_group != NULL) {
                 xEventGroupClearBits(esp_event_group, ESP_STA_CONNECTED_BIT << esp_event_offset);
                 xEventGroupSetBits(esp_event_group, ESP_STA_DISCONNECTED_BIT << esp_event_offset);
             }
             break;
+#endif
+#if WIFI_ENABLE_AP
         /* AP events */
         case SYSTEM_EVENT_AP_START:
+            link_event_push(WIFI_LINK_AP_START, event);
             wifi_current_status.ap_started = true;
             ESP_ERROR_CHECK(esp_wifi_internal_reg_rxcb(WIFI_IF_AP, ap_packet_handler));
             if (esp_event_group != NULL) {
@@ -128,6 +667,7 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
             }
             break;
         case SYSTEM_EVENT_AP_STOP:
+            link_event_push(WIFI_LINK_AP_STOP, event);
             wifi_current_status.ap_started = false;
             if (esp_event_group != NULL) {
                 xEventGroupClearBits(esp_event_group, ESP_AP_STARTED_BIT << esp_event_offset);
@@ -135,32 +675,35 @@ esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
             }
             break;
         case SYSTEM_EVENT_AP_STACONNECTED:
+            link_event_push(WIFI_LINK_AP_STACONNECTED, event);
             break;
         case SYSTEM_EVENT_AP_STADISCONNECTED:
+            link_event_push(WIFI_LINK_AP_STADISCONNECTED, event);
             break;
+#endif
     }
     return ESP_OK;
 }
 
-/*
- Wifi frame descriptors storage. 
- */
-typedef struct frame_list {
-    uint16_t length;
-    void* buffer;
-    void* l2_frame; /* the whole frame, to free with `esp_wifi_internal_free_rx_buffer` after transmmission to the stack. */
-} wifi_frame_t;
-
-static QueueHandle_t ap_frames;
-static QueueHandle_t sta_frames;
-
-static const MAX_NUMBER_OF_FRAMES = 20;
-
 esp_err_t wifi_initialize() {
     esp_err_t res;
 
-    ap_frames = xQueueCreate(MAX_NUMBER_OF_FRAMES, sizeof(wifi_frame_t));
-    sta_frames = xQueueCreate(MAX_NUMBER_OF_FRAMES, sizeof(wifi_frame_t));
+#if WIFI_ENABLE_AP
+    if ((res = rx_queue_init(&ap_rx)) != ESP_OK) {
+        return res;
+    }
+#endif
+#if WIFI_ENABLE_STA
+    if ((res = rx_queue_init(&sta_rx)) != ESP_OK) {
+        return res;
+    }
+#endif
+#if WIFI_ENABLE_ESPNOW
+    if ((res = rx_queue_init(&espnow_rx)) != ESP_OK) {
+        return res;
+    }
+#endif
+    link_events = xQueueCreate(MAX_NUMBER_OF_LINK_EVENTS, sizeof(wifi_link_event_t));
 
     ESP_ERROR_CHECK(nvs_flash_init());
 
@@ -200,62 +743,638 @@ esp_err_t wifi_deinitialize() {
 
 
 
-esp_err_t sta_packet_handler(void *buffer, uint16_t len, void *eb) {
+/*
+ lwIP error codes
+ */
+#define ERR_OK 0
+#define ERR_ARG -16
+
+/*
+ Queue a received frame on `rx`, dropping the oldest one if the queue is full.
+ */
+static void rx_queue_push(wifi_rx_queue_t* rx, void *buffer, uint16_t len, void *eb) {
     wifi_frame_t tmp_buffer;
 
     /* drop one frame */
-    if (uxQueueMessagesWaitingFromISR(ap_frames) == MAX_NUMBER_OF_FRAMES) {
-        printf("[wifi] Too many STA frames pending, dropping the oldest one.\r");
-        xQueueReceiveFromISR(sta_frames, &tmp_buffer, NULL);
-        esp_wifi_internal_free_rx_buffer(tmp_buffer.l2_frame);
+    if (uxQueueMessagesWaitingFromISR(rx->frames) == MAX_NUMBER_OF_FRAMES) {
+        printf("[wifi] Too many %s frames pending, dropping the oldest one.\r", rx->name);
+        xQueueReceiveFromISR(rx->frames, &tmp_buffer, NULL);
+        rx_frame_free(&tmp_buffer);
     }
 
     tmp_buffer.buffer = buffer;
     tmp_buffer.length = len;
     tmp_buffer.l2_frame = eb;
-    xQueueSendFromISR(sta_frames, &tmp_buffer, NULL);
-    xEventGroupSetBits(esp_event_group, ESP_STA_FRAME_RECEIVED_BIT << esp_event_offset);
+    tmp_buffer.enqueued_us = histogram_now_us();
+    xQueueSendFromISR(rx->frames, &tmp_buffer, NULL);
+    rx_queue_notify(rx, 1, 1);
+}
+
+/*
+ ARP responder.
+ Requests targeting one of the registered bindings are answered directly from the rx callback,
+ so that they never reach the frame queues nor the OCaml stack.
+ */
+#define ARP_MAX_BINDINGS    4
+#define ARP_FRAME_LENGTH    42
+#define ETH_ADDR_LEN        6
+#define IPV4_ADDR_LEN       4
+
+typedef struct arp_binding {
+    bool             used;
+    wifi_interface_t interface;
+    uint8_t          ip[IPV4_ADDR_LEN];
+    uint8_t          mac[ETH_ADDR_LEN];
+} arp_binding_t;
+
+static portMUX_TYPE arp_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool arp_enabled = false;
+static arp_binding_t arp_bindings[ARP_MAX_BINDINGS];
+static wifi_arp_stats arp_stats = {
+    .answered  = 0,
+    .passed_up = 0
+};
+
+static arp_binding_t* arp_find_binding(wifi_interface_t interface, const uint8_t* ip) {
+    for (int i = 0; i < ARP_MAX_BINDINGS; i++) {
+        if (arp_bindings[i].used 
+            && arp_bindings[i].interface == interface 
+            && memcmp(arp_bindings[i].ip, ip, IPV4_ADDR_LEN) == 0) {
+            return &arp_bindings[i];
+        }
+    }
+    return NULL;
+}
+
+static bool arp_is_request(const uint8_t* frame, uint16_t len) {
+    /* Ethertype ARP, Ethernet/IPv4 addresses, operation request. */
+    return len >= ARP_FRAME_LENGTH
+        && frame[12] == 0x08 && frame[13] == 0x06
+        && frame[14] == 0x00 && frame[15] == 0x01
+        && frame[16] == 0x08 && frame[17] == 0x00
+        && frame[18] == ETH_ADDR_LEN && frame[19] == IPV4_ADDR_LEN
+        && frame[20] == 0x00 && frame[21] == 0x01;
+}
+
+/*
+ Returns true if the frame was an ARP request that has been answered, in which case it must not be passed up.
+ */
+static bool arp_try_answer(wifi_interface_t interface, const uint8_t* frame, uint16_t len) {
+    uint8_t reply[ARP_FRAME_LENGTH];
+    uint8_t mac[ETH_ADDR_LEN];
+    bool found;
+
+    if (!arp_enabled || !arp_is_request(frame, len)) {
+        return false;
+    }
+
+    const uint8_t* sender_mac = frame + 22;
+    const uint8_t* sender_ip  = frame + 28;
+    const uint8_t* target_ip  = frame + 38;
+
+    /* Leave gratuitous ARP to the stack, it may be reporting an address conflict. */
+    found = memcmp(sender_ip, target_ip, IPV4_ADDR_LEN) != 0;
+    if (found) {
+        portENTER_CRITICAL(&arp_lock);
+        arp_binding_t* binding = arp_find_binding(interface, target_ip);
+        found = binding != NULL;
+        if (found) {
+            memcpy(mac, binding->mac, ETH_ADDR_LEN);
+        }
+        portEXIT_CRITICAL(&arp_lock);
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    /* Ethernet header */
+    memcpy(reply, sender_mac, ETH_ADDR_LEN);
+    memcpy(reply + 6, mac, ETH_ADDR_LEN);
+    /* Ethertype and ARP header are the same as the request's, apart from the operation. */
+    memcpy(reply + 12, frame + 12, 8);
+    reply[20] = 0x00;
+    reply[21] = 0x02;
+    /* Sender is us, target is the requester. */
+    memcpy(reply + 22, mac, ETH_ADDR_LEN);
+    memcpy(reply + 28, target_ip, IPV4_ADDR_LEN);
+    memcpy(reply + 32, sender_mac, ETH_ADDR_LEN);
+    memcpy(reply + 38, sender_ip, IPV4_ADDR_LEN);
+
+    if (esp_wifi_internal_tx(interface, reply, ARP_FRAME_LENGTH) != ERR_OK) {
+        return false;
+    }
+    portENTER_CRITICAL(&arp_lock);
+    arp_stats.answered++;
+    portEXIT_CRITICAL(&arp_lock);
+    return true;
+}
+
+/*
+ Called by the rx callbacks on frames that end up queued for the stack, once the bridge has had its say.
+ */
+static void arp_count_passed_up(const uint8_t* frame, uint16_t len) {
+    if (arp_enabled && arp_is_request(frame, len)) {
+        portENTER_CRITICAL(&arp_lock);
+        arp_stats.passed_up++;
+        portEXIT_CRITICAL(&arp_lock);
+    }
+}
+
+void wifi_arp_set_enabled(bool enabled) {
+    arp_enabled = enabled;
+}
+
+int wifi_arp_add_binding(wifi_interface_t interface, const uint8_t* ip, const uint8_t* mac) {
+    int result = WIFI_ERR_INVAL;
+
+    if (interface == WIFI_IF_ESPNOW || rx_queue_of(interface) == NULL) {
+        return WIFI_ERR_INVAL;
+    }
+
+    portENTER_CRITICAL(&arp_lock);
+    arp_binding_t* binding = arp_find_binding(interface, ip);
+    for (int i = 0; binding == NULL && i < ARP_MAX_BINDINGS; i++) {
+        if (!arp_bindings[i].used) {
+            binding = &arp_bindings[i];
+        }
+    }
+    if (binding != NULL) {
+        binding->interface = interface;
+        memcpy(binding->ip, ip, IPV4_ADDR_LEN);
+        memcpy(binding->mac, mac, ETH_ADDR_LEN);
+        binding->used = true;
+        result = WIFI_ERR_OK;
+    }
+    portEXIT_CRITICAL(&arp_lock);
+
+    return result;
+}
+
+int wifi_arp_remove_binding(wifi_interface_t interface, const uint8_t* ip) {
+    int result = WIFI_ERR_INVAL;
+
+    portENTER_CRITICAL(&arp_lock);
+    arp_binding_t* binding = arp_find_binding(interface, ip);
+    if (binding != NULL) {
+        binding->used = false;
+        result = WIFI_ERR_OK;
+    }
+    portEXIT_CRITICAL(&arp_lock);
+
+    return result;
+}
+
+wifi_arp_stats wifi_arp_get_stats() {
+    wifi_arp_stats st;
+
+    portENTER_CRITICAL(&arp_lock);
+    st = arp_stats;
+    portEXIT_CRITICAL(&arp_lock);
+    return st;
+}
+
+#if WIFI_ENABLE_BRIDGE
+/*
+ L2 bridge with MAC address translation.
+ In APSTA mode, frames received on one interface and not addressed to us are sent out of the other one
+ directly from the rx callback. Group-addressed frames are both forwarded and passed up.
+
+ The station talks to the upstream AP in 3-address mode, so it can only send frames from, and receive 
+ frames for, its own MAC address. Going upstream, the source address (and the ARP sender address) is
+ rewritten to the STA MAC, and the client IPv4 address is learnt. Coming back, frames for the STA MAC
+ are sent to the client owning their destination IPv4 address, if any, and passed up otherwise. 
+ Client addresses are learnt from ARP, IPv4 and DHCP; DHCP requests are marked broadcast so that 
+ the server's reply reaches the clients. Only IPv4 and ARP are translated.
+ */
+#define BRIDGE_MAX_ENTRIES      32
+#define BRIDGE_DEFAULT_AGING_S  300
+#define BRIDGE_MAX_FRAME_LENGTH 1536
+
+#define ETH_HEADER_LENGTH       14
+#define ETH_TYPE_IPV4           0x0800
+#define ETH_TYPE_ARP            0x0806
+#define IPV4_PROTOCOL_UDP       17
+#define DHCP_SERVER_PORT        67
+#define DHCP_CLIENT_PORT        68
+
+typedef struct bridge_entry {
+    bool             used;
+    wifi_interface_t interface;
+    uint8_t          mac[ETH_ADDR_LEN];
+    int64_t          last_seen_us;
+} bridge_entry_t;
+
+/* Client IPv4 address to MAC address, for the translation of downstream frames. */
+typedef struct bridge_ip_entry {
+    bool             used;
+    uint8_t          ip[IPV4_ADDR_LEN];
+    uint8_t          mac[ETH_ADDR_LEN];
+    int64_t          last_seen_us;
+} bridge_ip_entry_t;
+
+typedef struct bridge_rate_limit {
+    uint32_t frames_per_s;  /* 0: no limit */
+    uint32_t burst;
+    uint32_t tokens;
+    int64_t  last_refill_us;
+} bridge_rate_limit_t;
+
+static portMUX_TYPE bridge_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool bridge_enabled = false;
+static uint8_t bridge_own_mac[2][ETH_ADDR_LEN];    /* indexed by ingress direction */
+static int64_t bridge_aging_us = BRIDGE_DEFAULT_AGING_S * 1000000LL;
+static bridge_entry_t bridge_table[BRIDGE_MAX_ENTRIES];
+static bridge_ip_entry_t bridge_ip_table[BRIDGE_MAX_ENTRIES];
+static bridge_rate_limit_t bridge_rate_limits[2];
+static wifi_bridge_stats bridge_stats;
+
+/* Translated copy of the frame being forwarded. Both rx callbacks run in the wifi task, one at a time. */
+static uint8_t bridge_tx_buffer[BRIDGE_MAX_FRAME_LENGTH];
+
+static bridge_entry_t* bridge_lookup(const uint8_t* mac, int64_t now) {
+    for (int i = 0; i < BRIDGE_MAX_ENTRIES; i++) {
+        if (bridge_table[i].used 
+            && now - bridge_table[i].last_seen_us <= bridge_aging_us
+            && memcmp(bridge_table[i].mac, mac, ETH_ADDR_LEN) == 0) {
+            return &bridge_table[i];
+        }
+    }
+    return NULL;
+}
+
+static void bridge_learn(wifi_interface_t interface, const uint8_t* mac, int64_t now) {
+    bridge_entry_t* entry = bridge_lookup(mac, now);
+
+    /* Otherwise take a free or expired slot, or evict the least recently seen entry. */
+    for (int i = 0; entry == NULL && i < BRIDGE_MAX_ENTRIES; i++) {
+        if (!bridge_table[i].used || now - bridge_table[i].last_seen_us > bridge_aging_us) {
+            entry = &bridge_table[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &bridge_table[0];
+        for (int i = 1; i < BRIDGE_MAX_ENTRIES; i++) {
+            if (bridge_table[i].last_seen_us < entry->last_seen_us) {
+                entry = &bridge_table[i];
+            }
+        }
+    }
+
+    entry->used = true;
+    entry->interface = interface;
+    memcpy(entry->mac, mac, ETH_ADDR_LEN);
+    entry->last_seen_us = now;
+}
+
+static bridge_ip_entry_t* bridge_ip_lookup(const uint8_t* ip, int64_t now) {
+    for (int i = 0; i < BRIDGE_MAX_ENTRIES; i++) {
+        if (bridge_ip_table[i].used 
+            && now - bridge_ip_table[i].last_seen_us <= bridge_aging_us
+            && memcmp(bridge_ip_table[i].ip, ip, IPV4_ADDR_LEN) == 0) {
+            return &bridge_ip_table[i];
+        }
+    }
+    return NULL;
+}
+
+static void bridge_ip_learn(const uint8_t* ip, const uint8_t* mac, int64_t now) {
+    static const uint8_t any[IPV4_ADDR_LEN] = { 0, 0, 0, 0 };
+
+    /* Our own addresses must never be resolved to a client. */
+    if (memcmp(ip, any, IPV4_ADDR_LEN) == 0 || (mac[0] & 0x01)
+        || memcmp(mac, bridge_own_mac[WIFI_BRIDGE_STA_TO_AP], ETH_ADDR_LEN) == 0
+        || memcmp(mac, bridge_own_mac[WIFI_BRIDGE_AP_TO_STA], ETH_ADDR_LEN) == 0) {
+        return;
+    }
+
+    portENTER_CRITICAL(&bridge_lock);
+    bridge_ip_entry_t* entry = bridge_ip_lookup(ip, now);
+    for (int i = 0; entry == NULL && i < BRIDGE_MAX_ENTRIES; i++) {
+        if (!bridge_ip_table[i].used || now - bridge_ip_table[i].last_seen_us > bridge_aging_us) {
+            entry = &bridge_ip_table[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &bridge_ip_table[0];
+        for (int i = 1; i < BRIDGE_MAX_ENTRIES; i++) {
+            if (bridge_ip_table[i].last_seen_us < entry->last_seen_us) {
+                entry = &bridge_ip_table[i];
+            }
+        }
+    }
+    entry->used = true;
+    memcpy(entry->ip, ip, IPV4_ADDR_LEN);
+    memcpy(entry->mac, mac, ETH_ADDR_LEN);
+    entry->last_seen_us = now;
+    portEXIT_CRITICAL(&bridge_lock);
+}
+
+static bool bridge_ip_resolve(const uint8_t* ip, uint8_t* mac, int64_t now) {
+    portENTER_CRITICAL(&bridge_lock);
+    bridge_ip_entry_t* entry = bridge_ip_lookup(ip, now);
+    if (entry != NULL) {
+        memcpy(mac, entry->mac, ETH_ADDR_LEN);
+    }
+    portEXIT_CRITICAL(&bridge_lock);
+    return entry != NULL;
+}
+
+/*
+ Whether `mac` is a client learnt behind the AP interface.
+ */
+static bool bridge_is_ap_client(const uint8_t* mac, int64_t now) {
+    portENTER_CRITICAL(&bridge_lock);
+    bridge_entry_t* entry = bridge_lookup(mac, now);
+    bool found = entry != NULL && entry->interface == WIFI_IF_AP;
+    portEXIT_CRITICAL(&bridge_lock);
+    return found;
+}
+
+static bool bridge_take_token(bridge_rate_limit_t* limit, int64_t now) {
+    if (limit->frames_per_s == 0) {
+        return true;
+    }
+    int64_t refill = (now - limit->last_refill_us) * limit->frames_per_s / 1000000;
+    if (refill >= limit->burst) {
+        limit->tokens = limit->burst;
+        limit->last_refill_us = now;
+    } else if (refill > 0) {
+        limit->tokens = limit->tokens + refill > limit->burst ? limit->burst : limit->tokens + refill;
+        limit->last_refill_us += refill * 1000000 / limit->frames_per_s;
+    }
+    if (limit->tokens == 0) {
+        return false;
+    }
+    limit->tokens--;
+    return true;
+}
+
+static inline uint16_t frame_get_u16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+/*
+ Offset of the BOOTP header if `frame` is a DHCP message from `src_port` to `dst_port`, 0 otherwise.
+ */
+static size_t frame_dhcp_offset(const uint8_t* frame, uint16_t len, uint16_t src_port, uint16_t dst_port) {
+    if (len < ETH_HEADER_LENGTH + 20 || frame_get_u16(frame + 12) != ETH_TYPE_IPV4 
+        || frame[ETH_HEADER_LENGTH + 9] != IPV4_PROTOCOL_UDP) {
+        return 0;
+    }
+    size_t udp = ETH_HEADER_LENGTH + (frame[ETH_HEADER_LENGTH] & 0x0f) * 4;
+    size_t bootp = udp + 8;
+    /* op .. chaddr */
+    if (len < bootp + 34 
+        || frame_get_u16(frame + udp) != src_port || frame_get_u16(frame + udp + 2) != dst_port) {
+        return 0;
+    }
+    return bootp;
+}
+
+/*
+ Upstream translation of a frame from an AP client: learn its address and make it come from the STA.
+ */
+static void bridge_translate_upstream(uint8_t* frame, uint16_t len, int64_t now) {
+    const uint8_t* sta_mac = bridge_own_mac[WIFI_BRIDGE_STA_TO_AP];
+    uint16_t type = frame_get_u16(frame + 12);
+    size_t bootp;
+
+    if (type == ETH_TYPE_ARP && len >= ARP_FRAME_LENGTH) {
+        bridge_ip_learn(frame + 28, frame + 22, now);
+        memcpy(frame + 22, sta_mac, ETH_ADDR_LEN);
+    } else if (type == ETH_TYPE_IPV4 && len >= ETH_HEADER_LENGTH + 20) {
+        bridge_ip_learn(frame + ETH_HEADER_LENGTH + 12, frame + ETH_ADDR_LEN, now);
+        /* The server would answer to the client MAC address, which the station never receives. */
+        if ((bootp = frame_dhcp_offset(frame, len, DHCP_CLIENT_PORT, DHCP_SERVER_PORT)) != 0) {
+            frame[bootp + 10] |= 0x80;
+            /* UDP checksum: optional in IPv4. */
+            frame[bootp - 2] = 0;
+            frame[bootp - 1] = 0;
+        }
+    }
+    memcpy(frame + ETH_ADDR_LEN, sta_mac, ETH_ADDR_LEN);
+}
+
+/*
+ Downstream translation of a frame for the STA MAC address: find the client it is for.
+ Returns false if it is for us.
+ */
+static bool bridge_translate_downstream(uint8_t* frame, uint16_t len, int64_t now) {
+    uint8_t mac[ETH_ADDR_LEN];
+    uint16_t type = frame_get_u16(frame + 12);
+
+    if (type == ETH_TYPE_ARP && len >= ARP_FRAME_LENGTH) {
+        if (!bridge_ip_resolve(frame + 38, mac, now)) {
+            return false;
+        }
+        memcpy(frame + 32, mac, ETH_ADDR_LEN);
+    } else if (type == ETH_TYPE_IPV4 && len >= ETH_HEADER_LENGTH + 20) {
+        if (!bridge_ip_resolve(frame + ETH_HEADER_LENGTH + 16, mac, now)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    memcpy(frame, mac, ETH_ADDR_LEN);
+    return true;
+}
+
+/*
+ Returns true if the frame has been consumed (forwarded or dropped), false if it must be passed up.
+ */
+static bool bridge_try_forward(wifi_interface_t ingress, const uint8_t* frame, uint16_t len) {
+    bool pass_up, forward, allowed;
+    bool copied = false;
+    size_t bootp;
+
+    if (!bridge_enabled || len < ETH_HEADER_LENGTH || len > BRIDGE_MAX_FRAME_LENGTH) {
+        return false;
+    }
+
+    const uint8_t* dst = frame;
+    const uint8_t* src = frame + ETH_ADDR_LEN;
+    wifi_bridge_direction direction = ingress == WIFI_IF_STA ? WIFI_BRIDGE_STA_TO_AP : WIFI_BRIDGE_AP_TO_STA;
+    wifi_interface_t egress = ingress == WIFI_IF_STA ? WIFI_IF_AP : WIFI_IF_STA;
+    const uint8_t* ingress_mac = bridge_own_mac[direction];
+    const uint8_t* egress_mac = bridge_own_mac[1 - direction];
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&bridge_lock);
+    if ((src[0] & 0x01) == 0) {
+        bridge_learn(ingress, src, now);
+    }
+    portEXIT_CRITICAL(&bridge_lock);
+
+    if (dst[0] & 0x01) {
+        /* Broadcast or multicast. DHCP replies tell which client got which address, 
+           as long as they are for one of the AP clients and not for the node itself. */
+        if (ingress == WIFI_IF_STA 
+            && (bootp = frame_dhcp_offset(frame, len, DHCP_SERVER_PORT, DHCP_CLIENT_PORT)) != 0
+            && bridge_is_ap_client(frame + bootp + 28, now)) {
+            bridge_ip_learn(frame + bootp + 16, frame + bootp + 28, now);
+        }
+        forward = true;
+        pass_up = true;
+    } else if (memcmp(dst, egress_mac, ETH_ADDR_LEN) == 0) {
+        forward = false;
+        pass_up = true;
+    } else if (memcmp(dst, ingress_mac, ETH_ADDR_LEN) == 0) {
+        /* For us, or for a client behind the STA address. */
+        forward = false;
+        if (ingress == WIFI_IF_STA) {
+            memcpy(bridge_tx_buffer, frame, len);
+            copied = true;
+            forward = bridge_translate_downstream(bridge_tx_buffer, len, now);
+        }
+        pass_up = !forward;
+    } else {
+        portENTER_CRITICAL(&bridge_lock);
+        bridge_entry_t* entry = bridge_lookup(dst, now);
+        forward = entry == NULL || entry->interface != ingress;
+        portEXIT_CRITICAL(&bridge_lock);
+        pass_up = false;
+    }
+
+    portENTER_CRITICAL(&bridge_lock);
+    if (!forward && !pass_up) {
+        bridge_stats.filtered++;
+    }
+    allowed = forward && bridge_take_token(&bridge_rate_limits[direction], now);
+    if (forward && !allowed) {
+        bridge_stats.rate_limited[direction]++;
+    }
+    if (pass_up) {
+        bridge_stats.punted++;
+    }
+    portEXIT_CRITICAL(&bridge_lock);
+
+    if (allowed) {
+        if (!copied) {
+            memcpy(bridge_tx_buffer, frame, len);
+        }
+        if (egress == WIFI_IF_STA) {
+            bridge_translate_upstream(bridge_tx_buffer, len, now);
+        }
+        bool sent = esp_wifi_internal_tx(egress, bridge_tx_buffer, len) == ERR_OK;
+        portENTER_CRITICAL(&bridge_lock);
+        if (sent) {
+            bridge_stats.forwarded[direction]++;
+        } else {
+            bridge_stats.tx_failed++;
+        }
+        portEXIT_CRITICAL(&bridge_lock);
+    }
+    return !pass_up;
+}
+
+esp_err_t wifi_bridge_set_enabled(bool enabled) {
+    uint8_t sta_mac[ETH_ADDR_LEN];
+    uint8_t ap_mac[ETH_ADDR_LEN];
+    esp_err_t res;
+
+    if (enabled) {
+        if ((res = esp_wifi_get_mac(WIFI_IF_STA, sta_mac)) != ESP_OK 
+            || (res = esp_wifi_get_mac(WIFI_IF_AP, ap_mac)) != ESP_OK) {
+            return res;
+        }
+    }
+
+    portENTER_CRITICAL(&bridge_lock);
+    if (enabled) {
+        memcpy(bridge_own_mac[WIFI_BRIDGE_STA_TO_AP], sta_mac, ETH_ADDR_LEN);
+        memcpy(bridge_own_mac[WIFI_BRIDGE_AP_TO_STA], ap_mac, ETH_ADDR_LEN);
+        memset(bridge_table, 0, sizeof(bridge_table));
+        memset(bridge_ip_table, 0, sizeof(bridge_ip_table));
+    }
+    bridge_enabled = enabled;
+    portEXIT_CRITICAL(&bridge_lock);
     return ESP_OK;
 }
 
+void wifi_bridge_set_aging(uint32_t aging_s) {
+    portENTER_CRITICAL(&bridge_lock);
+    bridge_aging_us = aging_s * 1000000LL;
+    portEXIT_CRITICAL(&bridge_lock);
+}
 
-esp_err_t ap_packet_handler(void *buffer, uint16_t len, void *eb) {
-    wifi_frame_t tmp_buffer;
+void wifi_bridge_set_rate_limit(wifi_bridge_direction direction, uint32_t frames_per_s, uint32_t burst) {
+    int64_t now = esp_timer_get_time();
 
-    /* drop one frame */
-    if (uxQueueMessagesWaitingFromISR(ap_frames) == MAX_NUMBER_OF_FRAMES) {
-        printf("[wifi] Too many AP frames pending, dropping the oldest one.\r");
-        xQueueReceiveFromISR(ap_frames, &tmp_buffer, NULL);
-        esp_wifi_internal_free_rx_buffer(tmp_buffer.l2_frame);
+    portENTER_CRITICAL(&bridge_lock);
+    bridge_rate_limits[direction].frames_per_s = frames_per_s;
+    bridge_rate_limits[direction].burst = burst > 0 ? burst : 1;
+    bridge_rate_limits[direction].tokens = bridge_rate_limits[direction].burst;
+    bridge_rate_limits[direction].last_refill_us = now;
+    portEXIT_CRITICAL(&bridge_lock);
+}
+
+wifi_bridge_stats wifi_bridge_get_stats() {
+    wifi_bridge_stats st;
+    portENTER_CRITICAL(&bridge_lock);
+    st = bridge_stats;
+    portEXIT_CRITICAL(&bridge_lock);
+    return st;
+}
+#else
+static bool bridge_try_forward(wifi_interface_t ingress, const uint8_t* frame, uint16_t len) {
+    return false;
+}
+
+esp_err_t wifi_bridge_set_enabled(bool enabled) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void wifi_bridge_set_aging(uint32_t aging_s) {
+}
+
+void wifi_bridge_set_rate_limit(wifi_bridge_direction direction, uint32_t frames_per_s, uint32_t burst) {
+}
+
+wifi_bridge_stats wifi_bridge_get_stats() {
+    wifi_bridge_stats st;
+    memset(&st, 0, sizeof(st));
+    return st;
+}
+#endif
+
+#if WIFI_ENABLE_STA
+esp_err_t sta_packet_handler(void *buffer, uint16_t len, void *eb) {
+    if (arp_try_answer(WIFI_IF_STA, buffer, len) || bridge_try_forward(WIFI_IF_STA, buffer, len)) {
+        esp_wifi_internal_free_rx_buffer(eb);
+        return ESP_OK;
     }
+    arp_count_passed_up(buffer, len);
+    rx_queue_push(&sta_rx, buffer, len, eb);
+    return ESP_OK;
+}
+#endif
 
-    tmp_buffer.buffer = buffer;
-    tmp_buffer.length = len;
-    tmp_buffer.l2_frame = eb;
-    xQueueSendFromISR(ap_frames, &tmp_buffer, NULL);
-    xEventGroupSetBits(esp_event_group, ESP_AP_FRAME_RECEIVED_BIT << esp_event_offset);
+
+#if WIFI_ENABLE_AP
+esp_err_t ap_packet_handler(void *buffer, uint16_t len, void *eb) {
+    if (arp_try_answer(WIFI_IF_AP, buffer, len) || bridge_try_forward(WIFI_IF_AP, buffer, len)) {
+        esp_wifi_internal_free_rx_buffer(eb);
+        return ESP_OK;
+    }
+    arp_count_passed_up(buffer, len);
+    rx_queue_push(&ap_rx, buffer, len, eb);
     return ESP_OK;
 }
+#endif
 
 int wifi_read(wifi_interface_t interface, uint8_t* buf, size_t* size) {
     int result;
     wifi_frame_t tmp_buffer;
 
-    QueueHandle_t frames;
-
-    int bit_to_set;
-
-    if (interface == WIFI_IF_AP) {
-        frames = ap_frames;
-        bit_to_set = ESP_AP_FRAME_RECEIVED_BIT << esp_event_offset;
-    } else if (interface == WIFI_IF_STA) {
-        frames = sta_frames;
-        bit_to_set = ESP_STA_FRAME_RECEIVED_BIT << esp_event_offset;
-    } else {
-        assert(false);
+    wifi_rx_queue_t* rx = rx_queue_of(interface);
+    if (rx == NULL) {
+        *size = 0;
+        return WIFI_ERR_INVAL;
     }
 
-    if(xQueueReceive(frames, &tmp_buffer, 0)) {
+    if(xQueueReceive(rx->frames, &tmp_buffer, 0)) {
+        histogram_add(rx->histograms.dwell, histogram_now_us() - tmp_buffer.enqueued_us);
         if (tmp_buffer.length > *size) {
             result = WIFI_ERR_INVAL;
             *size = 0;
@@ -264,15 +1383,11 @@ int wifi_read(wifi_interface_t interface, uint8_t* buf, size_t* size) {
             *size = tmp_buffer.length;
             memcpy(buf, tmp_buffer.buffer, tmp_buffer.length);
         }
-        esp_wifi_internal_free_rx_buffer(tmp_buffer.l2_frame);
+        rx_frame_free(&tmp_buffer);
 
         /* Update event group status. */
-        if (uxQueueMessagesWaiting(frames) == 0 && esp_event_group != NULL) {
-            /* Between those two lines an ISR can happen. So after that we'll make sure that if a frame has been received the event has been registered.*/
-            xEventGroupClearBits(esp_event_group, bit_to_set);
-            if (uxQueueMessagesWaiting(frames) >= 1) {
-                xEventGroupSetBits(esp_event_group, bit_to_set);
-            }
+        if (uxQueueMessagesWaiting(rx->frames) == 0) {
+            rx_queue_rearm(rx);
         }
     } else {
         result = WIFI_ERR_AGAIN;
@@ -282,16 +1397,97 @@ int wifi_read(wifi_interface_t interface, uint8_t* buf, size_t* size) {
     return result;
 }
 
-/*
- lwIP error codes
- */
-#define ERR_OK 0
-#define ERR_ARG -16
+int wifi_peek_length(wifi_interface_t interface, size_t* length) {
+    wifi_frame_t tmp_buffer;
+
+    wifi_rx_queue_t* rx = rx_queue_of(interface);
+    *length = 0;
+    if (rx == NULL) {
+        return WIFI_ERR_INVAL;
+    }
+
+    if (!xQueuePeek(rx->frames, &tmp_buffer, 0)) {
+        return WIFI_ERR_AGAIN;
+    }
+    *length = tmp_buffer.length;
+    return WIFI_ERR_OK;
+}
+
+int wifi_read_chain(wifi_interface_t interface, uint8_t** bufs, const size_t* sizes, int count, size_t* length) {
+    wifi_frame_t tmp_buffer;
+    size_t capacity = 0;
+    size_t copied = 0;
+
+    wifi_rx_queue_t* rx = rx_queue_of(interface);
+    *length = 0;
+    if (rx == NULL) {
+        return WIFI_ERR_INVAL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        capacity += sizes[i];
+    }
+
+    if (!xQueuePeek(rx->frames, &tmp_buffer, 0)) {
+        return WIFI_ERR_AGAIN;
+    }
+    if (tmp_buffer.length > capacity) {
+        return WIFI_ERR_INVAL;
+    }
+
+    xQueueReceive(rx->frames, &tmp_buffer, 0);
+    if (tmp_buffer.length > capacity) {
+        /* The peeked frame has been dropped by the rx callback in between, and the next one is too large.
+           Put it back, unless the queue has been filled up again meanwhile. */
+        if (xQueueSendToFront(rx->frames, &tmp_buffer, 0) != pdTRUE) {
+            rx_frame_free(&tmp_buffer);
+        }
+        return WIFI_ERR_INVAL;
+    }
+    histogram_add(rx->histograms.dwell, histogram_now_us() - tmp_buffer.enqueued_us);
+
+    for (int i = 0; i < count && copied < tmp_buffer.length; i++) {
+        size_t chunk = tmp_buffer.length - copied;
+        if (chunk > sizes[i]) {
+            chunk = sizes[i];
+        }
+        memcpy(bufs[i], (uint8_t*) tmp_buffer.buffer + copied, chunk);
+        copied += chunk;
+    }
+    *length = copied;
+    rx_frame_free(&tmp_buffer);
+
+    if (uxQueueMessagesWaiting(rx->frames) == 0) {
+        rx_queue_rearm(rx);
+    }
+    return WIFI_ERR_OK;
+}
+
+#if WIFI_ENABLE_ESPNOW
+static int espnow_write(uint8_t* buf, size_t* size);
+#endif
 
 int wifi_write(wifi_interface_t interface, uint8_t* buf, size_t* size) {
     int result = -1;
+    uint32_t start;
+
+    wifi_rx_queue_t* rx = rx_queue_of(interface);
+    if (rx == NULL) {
+        return WIFI_ERR_INVAL;
+    }
 
+#if WIFI_ENABLE_ESPNOW
+    if (interface == WIFI_IF_ESPNOW) {
+        start = histogram_now_us();
+        result = espnow_write(buf, size);
+        histogram_add(rx->histograms.tx, histogram_now_us() - start);
+        return result;
+    }
+#endif
+
+    start = histogram_now_us();
     result = esp_wifi_internal_tx(interface, buf, *size);
+    histogram_add(rx->histograms.tx, histogram_now_us() - start);
 
     switch(result){
         case ERR_OK:
@@ -308,3 +1504,179 @@ int wifi_write(wifi_interface_t interface, uint8_t* buf, size_t* size) {
     }
     return result;
 }
+
+#if WIFI_ENABLE_ESPNOW
+/*
+ ESP-NOW link.
+ Received payloads are copied (the driver only lends them for the duration of the callback) 
+ behind the sender MAC address and queued on `espnow_rx`.
+ */
+#define ESPNOW_ADDR_LEN ESP_NOW_ETH_ALEN
+
+static portMUX_TYPE espnow_lock = portMUX_INITIALIZER_UNLOCKED;
+static wifi_espnow_stats espnow_stats = {
+    .tx_success = 0,
+    .tx_fail    = 0,
+    .tx_pending = 0,
+    .rx_dropped = 0
+};
+
+static void espnow_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int len) {
+    uint8_t* buffer = malloc(ESPNOW_ADDR_LEN + len);
+    if (buffer == NULL) {
+        portENTER_CRITICAL(&espnow_lock);
+        espnow_stats.rx_dropped++;
+        portEXIT_CRITICAL(&espnow_lock);
+        return;
+    }
+    memcpy(buffer, mac_addr, ESPNOW_ADDR_LEN);
+    memcpy(buffer + ESPNOW_ADDR_LEN, data, len);
+    rx_queue_push(&espnow_rx, buffer, ESPNOW_ADDR_LEN + len, NULL);
+}
+
+static void espnow_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status) {
+    uint32_t pending;
+
+    portENTER_CRITICAL(&espnow_lock);
+    if (status == ESP_NOW_SEND_SUCCESS) {
+        espnow_stats.tx_success++;
+    } else {
+        espnow_stats.tx_fail++;
+    }
+    if (espnow_stats.tx_pending > 0) {
+        espnow_stats.tx_pending--;
+    }
+    pending = espnow_stats.tx_pending;
+    portEXIT_CRITICAL(&espnow_lock);
+
+    if (pending == 0 && esp_event_group != NULL) {
+        xEventGroupSetBits(esp_event_group, ESP_ESPNOW_SEND_DONE_BIT << esp_event_offset);
+    }
+}
+
+static int espnow_write(uint8_t* buf, size_t* size) {
+    if (*size <= ESPNOW_ADDR_LEN || *size > ESPNOW_ADDR_LEN + ESP_NOW_MAX_DATA_LEN) {
+        return WIFI_ERR_INVAL;
+    }
+
+    portENTER_CRITICAL(&espnow_lock);
+    espnow_stats.tx_pending++;
+    portEXIT_CRITICAL(&espnow_lock);
+    if (esp_event_group != NULL) {
+        xEventGroupClearBits(esp_event_group, ESP_ESPNOW_SEND_DONE_BIT << esp_event_offset);
+    }
+
+    esp_err_t res = esp_now_send(buf, buf + ESPNOW_ADDR_LEN, *size - ESPNOW_ADDR_LEN);
+    if (res == ESP_OK) {
+        return WIFI_ERR_OK;
+    }
+
+    /* No completion callback will come for this one. */
+    espnow_send_cb(buf, ESP_NOW_SEND_FAIL);
+    printf("ESPNOW WRITE ERROR: %d -> %d\n", *size, res);
+    switch (res) {
+        case ESP_ERR_ESPNOW_ARG:
+        case ESP_ERR_ESPNOW_NOT_FOUND:
+            return WIFI_ERR_INVAL;
+        default:
+            return WIFI_ERR_UNSPEC;
+    }
+}
+
+esp_err_t wifi_espnow_start() {
+    esp_err_t res;
+    if ((res = esp_now_init()) != ESP_OK) {
+        return res;
+    }
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(espnow_recv_cb));
+    ESP_ERROR_CHECK(esp_now_register_send_cb(espnow_send_cb));
+    if (esp_event_group != NULL) {
+        xEventGroupSetBits(esp_event_group, ESP_ESPNOW_SEND_DONE_BIT << esp_event_offset);
+    }
+    return ESP_OK;
+}
+
+esp_err_t wifi_espnow_stop() {
+    wifi_frame_t tmp_buffer;
+    esp_err_t res;
+
+    if ((res = esp_now_deinit()) != ESP_OK) {
+        return res;
+    }
+    /* Completions of sends still in flight will never come. */
+    portENTER_CRITICAL(&espnow_lock);
+    espnow_stats.tx_pending = 0;
+    portEXIT_CRITICAL(&espnow_lock);
+    if (esp_event_group != NULL) {
+        xEventGroupSetBits(esp_event_group, ESP_ESPNOW_SEND_DONE_BIT << esp_event_offset);
+    }
+    while (xQueueReceive(espnow_rx.frames, &tmp_buffer, 0)) {
+        rx_frame_free(&tmp_buffer);
+    }
+    rx_queue_rearm(&espnow_rx);
+    return ESP_OK;
+}
+
+esp_err_t wifi_espnow_set_pmk(const uint8_t* pmk) {
+    return esp_now_set_pmk(pmk);
+}
+
+esp_err_t wifi_espnow_add_peer(const uint8_t* mac, uint8_t channel, wifi_interface_t interface, const uint8_t* lmk) {
+    esp_now_peer_info_t peer;
+    memset(&peer, 0, sizeof(peer));
+
+    if (interface != WIFI_IF_STA && interface != WIFI_IF_AP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(peer.peer_addr, mac, ESPNOW_ADDR_LEN);
+    peer.channel = channel;
+    peer.ifidx = interface;
+    if (lmk != NULL) {
+        memcpy(peer.lmk, lmk, ESP_NOW_KEY_LEN);
+        peer.encrypt = true;
+    }
+
+    if (esp_now_is_peer_exist(mac)) {
+        return esp_now_mod_peer(&peer);
+    }
+    return esp_now_add_peer(&peer);
+}
+
+esp_err_t wifi_espnow_del_peer(const uint8_t* mac) {
+    return esp_now_del_peer(mac);
+}
+
+wifi_espnow_stats wifi_espnow_get_stats() {
+    wifi_espnow_stats st;
+    portENTER_CRITICAL(&espnow_lock);
+    st = espnow_stats;
+    portEXIT_CRITICAL(&espnow_lock);
+    return st;
+}
+#else
+esp_err_t wifi_espnow_start() {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t wifi_espnow_stop() {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t wifi_espnow_set_pmk(const uint8_t* pmk) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t wifi_espnow_add_peer(const uint8_t* mac, uint8_t channel, wifi_interface_t interface, const uint8_t* lmk) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t wifi_espnow_del_peer(const uint8_t* mac) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+wifi_espnow_stats wifi_espnow_get_stats() {
+    wifi_espnow_stats st = { .tx_success = 0, .tx_fail = 0, .tx_pending = 0, .rx_dropped = 0 };
+    return st;
+}
+#endif
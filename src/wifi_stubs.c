@@ -15,6 +15,7 @@
 #include "nvs_flash.h"
 #include "driver/gpio.h"
 #include "esp_wifi_internal.h"
+#include "esp_now.h"
 
 #include "freertos/event_groups.h"
 #include "string.h"
@@ -27,6 +28,7 @@
 
 #define ML_WIFI_IF_STA     Val_int(0)
 #define ML_WIFI_IF_AP      Val_int(1)
+#define ML_WIFI_IF_ESPNOW  Val_int(2)
 
 #define ML_WIFI_AUTH_OPEN              Val_int(0)
 #define ML_WIFI_AUTH_WPA_PSK           Val_int(1)
@@ -58,6 +60,28 @@ result_fail (value error) {
     CAMLreturn (res);
 }
 
+/*
+ Stub for an external whose role is not compiled in (see WIFI_ENABLE_* in wifi.h).
+ */
+#define ML_WIFI_UNSUPPORTED(name)                           \
+    CAMLprim value name(value unit) {                       \
+        return result_fail(ML_WIFI_ERROR_UNSPECIFIED);      \
+    }
+
+/*
+ Same for a stats external, returning a record of `size` zero counters.
+ */
+#define ML_WIFI_UNSUPPORTED_STATS(name, size)               \
+    CAMLprim value name(value unit) {                       \
+        CAMLparam0 ();                                      \
+        CAMLlocal1 (v_result);                              \
+        v_result = caml_alloc_tuple(size);                  \
+        for (int i = 0; i < (size); i++) {                  \
+            Store_field(v_result, i, Val_int(0));           \
+        }                                                   \
+        CAMLreturn (v_result);                              \
+    }
+
 CAMLprim 
 value ml_wifi_initialize(value unit) {
     CAMLparam0 ();
@@ -148,6 +172,7 @@ value ml_wifi_stop(value unit) {
     CAMLreturn (result_ok(Val_unit));
 }
 
+#if WIFI_ENABLE_AP
 CAMLprim 
 value ml_wifi_ap_set_config(value config) {
     CAMLparam1 (config);
@@ -271,12 +296,18 @@ value ml_wifi_ap_get_config(value unit) {
 
     CAMLreturn (result_ok(ml_config));
 }
+#else
+ML_WIFI_UNSUPPORTED(ml_wifi_ap_set_config)
+ML_WIFI_UNSUPPORTED(ml_wifi_ap_get_config)
+#endif
 
+#if WIFI_ENABLE_STA
 CAMLprim 
 value ml_wifi_sta_set_config(value config) {
     CAMLparam1 (config);
 
     wifi_sta_config_t sta_config;
+    memset(&sta_config, 0, sizeof(sta_config));
 
     /* copy ssid */
     int len = caml_string_length(Field(config, 0));
@@ -292,13 +323,8 @@ value ml_wifi_sta_set_config(value config) {
     }
     memcpy(&sta_config.password, Bytes_val(Field(config, 1)), len+1);
 
-    sta_config.bssid_set = false;
-
-    wifi_config_t esp_config = {
-        .sta = sta_config
-    };
-
-    if (esp_wifi_set_config(WIFI_IF_STA, &esp_config) != ESP_OK) {
+    /* BSSID and channel are filled from the fast join cache. */
+    if (wifi_sta_set_config(&sta_config) != ESP_OK) {
         CAMLreturn (result_fail(0));
     }
 
@@ -327,12 +353,16 @@ value ml_wifi_sta_get_config(value unit) {
 
     CAMLreturn (result_ok(ml_config));
 }
+#else
+ML_WIFI_UNSUPPORTED(ml_wifi_sta_set_config)
+ML_WIFI_UNSUPPORTED(ml_wifi_sta_get_config)
+#endif
 
 CAMLprim 
 value ml_wifi_connect(value unit) {
     CAMLparam0 ();
 
-    if (esp_wifi_connect() != ESP_OK) {
+    if (wifi_sta_connect() != ESP_OK) {
         CAMLreturn (result_fail(0));
     }
 
@@ -350,6 +380,7 @@ value ml_wifi_disconnect(value unit) {
     CAMLreturn (result_ok(Val_unit));
 }
 
+#if WIFI_ENABLE_SCAN
 CAMLprim 
 value ml_wifi_scan_start(value unit) {
     CAMLparam0 ();
@@ -439,78 +470,272 @@ value ml_wifi_scan_get_array(value v_count) {
 
     CAMLreturn (result_ok(result));
 }
+#else
+ML_WIFI_UNSUPPORTED(ml_wifi_scan_start)
+ML_WIFI_UNSUPPORTED(ml_wifi_scan_stop)
+ML_WIFI_UNSUPPORTED(ml_wifi_scan_count)
+ML_WIFI_UNSUPPORTED(ml_wifi_scan_get_array)
+#endif
+
+/*
+ Per-frame entry points.
+ These are `[@@noalloc]` externals with untagged integers: they return the frame length (read) 
+ or 0 (write) on success, and a negated WIFI_ERR_* code on failure. The `result` API is built 
+ on top of them in OCaml.
+ */
+static const wifi_interface_t ml_wifi_interfaces[] = {
+    WIFI_IF_STA,    /* IF_STA */
+    WIFI_IF_AP,     /* IF_AP */
+    WIFI_IF_ESPNOW  /* IF_ESPNOW */
+};
+
+CAMLprim 
+intnat ml_wifi_read_untagged(value v_interface, value v_buffer, intnat buffer_size) {
+    uint8_t* buf    = Caml_ba_data_val(v_buffer);
+    size_t size     = buffer_size;
+
+    int error_code = wifi_read(ml_wifi_interfaces[Int_val(v_interface)], buf, &size);
+    if (error_code != WIFI_ERR_OK) {
+        return -error_code;
+    }
+    return size;
+}
+
+CAMLprim 
+value ml_wifi_read_byte(value v_interface, value v_buffer, value v_buffer_size) {
+    return Val_long(ml_wifi_read_untagged(v_interface, v_buffer, Long_val(v_buffer_size)));
+}
+
+CAMLprim 
+intnat ml_wifi_peek_length_untagged(value v_interface) {
+    size_t length;
+
+    int error_code = wifi_peek_length(ml_wifi_interfaces[Int_val(v_interface)], &length);
+    if (error_code != WIFI_ERR_OK) {
+        return -error_code;
+    }
+    return length;
+}
+
+CAMLprim 
+value ml_wifi_peek_length_byte(value v_interface) {
+    return Val_long(ml_wifi_peek_length_untagged(v_interface));
+}
+
+#define ML_WIFI_MAX_CHAIN 8
+
+/*
+ `v_chain` is a `Cstruct.t list`, Cstruct.t being the record { buffer; off; len }.
+ */
+CAMLprim 
+intnat ml_wifi_read_chain_untagged(value v_interface, value v_chain) {
+    uint8_t* bufs[ML_WIFI_MAX_CHAIN];
+    size_t sizes[ML_WIFI_MAX_CHAIN];
+    size_t length;
+    int count = 0;
+
+    for (; v_chain != Val_emptylist; v_chain = Field(v_chain, 1)) {
+        value v_cstruct = Field(v_chain, 0);
+        if (count == ML_WIFI_MAX_CHAIN) {
+            return -WIFI_ERR_INVAL;
+        }
+        bufs[count]  = (uint8_t*) Caml_ba_data_val(Field(v_cstruct, 0)) + Long_val(Field(v_cstruct, 1));
+        sizes[count] = Long_val(Field(v_cstruct, 2));
+        count++;
+    }
+
+    int error_code = wifi_read_chain(ml_wifi_interfaces[Int_val(v_interface)], bufs, sizes, count, &length);
+    if (error_code != WIFI_ERR_OK) {
+        return -error_code;
+    }
+    return length;
+}
+
+CAMLprim 
+value ml_wifi_read_chain_byte(value v_interface, value v_chain) {
+    return Val_long(ml_wifi_read_chain_untagged(v_interface, v_chain));
+}
 
 CAMLprim 
-value ml_wifi_read(value v_interface, value v_buffer, value v_buffer_size) {
-    CAMLparam3 (v_interface, v_buffer, v_buffer_size);
+intnat ml_wifi_write_untagged(value v_interface, value v_buffer, intnat buffer_size) {
+    uint8_t* buf    = Caml_ba_data_val(v_buffer);
+    size_t size     = buffer_size;
+
+    return -wifi_write(ml_wifi_interfaces[Int_val(v_interface)], buf, &size);
+}
+
+CAMLprim 
+value ml_wifi_write_byte(value v_interface, value v_buffer, value v_buffer_size) {
+    return Val_long(ml_wifi_write_untagged(v_interface, v_buffer, Long_val(v_buffer_size)));
+}
 
+CAMLprim 
+value ml_wifi_get_mac(value v_interface) {
+    CAMLparam1 (v_interface);
+    CAMLlocal1 (v_result);
+    
     wifi_interface_t interface;
     switch (v_interface) {
         case ML_WIFI_IF_AP:
             interface = WIFI_IF_AP;
             break;
         case ML_WIFI_IF_STA:
+        case ML_WIFI_IF_ESPNOW:
+            /* ESP-NOW frames are sent from the station address. */
             interface = WIFI_IF_STA;
             break;
     }
-    uint8_t* buf    = Caml_ba_data_val(v_buffer);
-    size_t size     = Long_val(v_buffer_size);
+    v_result = caml_alloc_string(6);
 
-    int error_code = wifi_read(interface, buf, &size);
+    if (esp_wifi_get_mac(interface, Bytes_val(v_result)) != ESP_OK) {
+        CAMLreturn (result_fail(0));
+    }
 
-    if (error_code != WIFI_ERR_OK) {
-        switch (error_code) {
-            case WIFI_ERR_AGAIN:
-                CAMLreturn (result_fail(ML_WIFI_ERROR_NOTHING_TO_READ));
-                break;
-            case WIFI_ERR_INVAL:
-                CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
-                break;
-            default:
-                CAMLreturn (result_fail(ML_WIFI_ERROR_UNSPECIFIED));
-                break;
-        }
+    CAMLreturn (result_ok(v_result));
+}
+
+#define ML_WIFI_STATUS_INITED         1
+#define ML_WIFI_STATUS_AP_STARTED     2
+#define ML_WIFI_STATUS_STA_STARTED    4
+#define ML_WIFI_STATUS_STA_CONNECTED  8
+
+CAMLprim
+intnat ml_wifi_get_status_untagged(value unit) {
+    wifi_status st = wifi_get_status();
+    return (st.wifi_inited   ? ML_WIFI_STATUS_INITED : 0)
+         | (st.ap_started    ? ML_WIFI_STATUS_AP_STARTED : 0)
+         | (st.sta_started   ? ML_WIFI_STATUS_STA_STARTED : 0)
+         | (st.sta_connected ? ML_WIFI_STATUS_STA_CONNECTED : 0);
+}
+
+CAMLprim
+value ml_wifi_get_status_byte(value unit) {
+    return Val_long(ml_wifi_get_status_untagged(unit));
+}
+
+#if WIFI_ENABLE_ESPNOW
+CAMLprim 
+value ml_wifi_espnow_start(value unit) {
+    CAMLparam0 ();
+
+    if (wifi_espnow_start() != ESP_OK) {
+        CAMLreturn (result_fail(0));
     }
 
-    CAMLreturn (result_ok(Val_int(size)));
+    CAMLreturn (result_ok(Val_unit));
 }
 
 CAMLprim 
-value ml_wifi_write(value v_interface, value v_buffer, value v_buffer_size) {
-    CAMLparam3 (v_interface, v_buffer, v_buffer_size);
+value ml_wifi_espnow_stop(value unit) {
+    CAMLparam0 ();
+
+    if (wifi_espnow_stop() != ESP_OK) {
+        CAMLreturn (result_fail(0));
+    }
+
+    CAMLreturn (result_ok(Val_unit));
+}
+
+CAMLprim 
+value ml_wifi_espnow_set_pmk(value v_pmk) {
+    CAMLparam1 (v_pmk);
+
+    if (caml_string_length(v_pmk) != ESP_NOW_KEY_LEN) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+    if (wifi_espnow_set_pmk(Bytes_val(v_pmk)) != ESP_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_UNSPECIFIED));
+    }
+
+    CAMLreturn (result_ok(Val_unit));
+}
+
+CAMLprim 
+value ml_wifi_espnow_add_peer(value v_peer) {
+    CAMLparam1 (v_peer);
+
+    value v_mac = Field(v_peer, 0);
+    int channel = Int_val(Field(v_peer, 1));
+    value v_lmk = Field(v_peer, 3);
+    const uint8_t* lmk = NULL;
 
     wifi_interface_t interface;
-    switch (v_interface) {
+    switch (Field(v_peer, 2)) {
         case ML_WIFI_IF_AP:
             interface = WIFI_IF_AP;
             break;
         case ML_WIFI_IF_STA:
             interface = WIFI_IF_STA;
             break;
+        default:
+            CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
     }
-    uint8_t* buf    = Caml_ba_data_val(v_buffer);
-    size_t size     = Long_val(v_buffer_size);
 
-    int error_code = wifi_write(interface, buf, &size);
-    
-    if (error_code != WIFI_ERR_OK) {
-        switch (error_code) {
-            case WIFI_ERR_INVAL:
-                CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
-                break;
-            default:
-                CAMLreturn (result_fail(ML_WIFI_ERROR_UNSPECIFIED));
-                break;
+    if (caml_string_length(v_mac) != ESP_NOW_ETH_ALEN || channel < 0 || channel > 14) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+    /* Some lmk */
+    if (Is_block(v_lmk)) {
+        if (caml_string_length(Field(v_lmk, 0)) != ESP_NOW_KEY_LEN) {
+            CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
         }
+        lmk = Bytes_val(Field(v_lmk, 0));
     }
+
+    if (wifi_espnow_add_peer(Bytes_val(v_mac), channel, interface, lmk) != ESP_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_UNSPECIFIED));
+    }
+
     CAMLreturn (result_ok(Val_unit));
 }
 
 CAMLprim 
-value ml_wifi_get_mac(value v_interface) {
-    CAMLparam1 (v_interface);
+value ml_wifi_espnow_del_peer(value v_mac) {
+    CAMLparam1 (v_mac);
+
+    if (caml_string_length(v_mac) != ESP_NOW_ETH_ALEN) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+    if (wifi_espnow_del_peer(Bytes_val(v_mac)) != ESP_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_UNSPECIFIED));
+    }
+
+    CAMLreturn (result_ok(Val_unit));
+}
+
+CAMLprim
+value ml_wifi_espnow_get_stats(value unit) {
+    CAMLparam0 ();
     CAMLlocal1 (v_result);
-    
+
+    wifi_espnow_stats st = wifi_espnow_get_stats();
+    v_result = caml_alloc_tuple(4);
+    Store_field(v_result, 0, Val_int(st.tx_success));
+    Store_field(v_result, 1, Val_int(st.tx_fail));
+    Store_field(v_result, 2, Val_int(st.tx_pending));
+    Store_field(v_result, 3, Val_int(st.rx_dropped));
+
+    CAMLreturn (v_result);
+}
+#else
+ML_WIFI_UNSUPPORTED(ml_wifi_espnow_start)
+ML_WIFI_UNSUPPORTED(ml_wifi_espnow_stop)
+ML_WIFI_UNSUPPORTED(ml_wifi_espnow_set_pmk)
+ML_WIFI_UNSUPPORTED(ml_wifi_espnow_add_peer)
+ML_WIFI_UNSUPPORTED(ml_wifi_espnow_del_peer)
+ML_WIFI_UNSUPPORTED_STATS(ml_wifi_espnow_get_stats, 4)
+#endif
+
+CAMLprim
+value ml_wifi_arp_set_enabled(value v_enabled) {
+    wifi_arp_set_enabled(Bool_val(v_enabled));
+    return Val_unit;
+}
+
+CAMLprim 
+value ml_wifi_arp_add_binding(value v_interface, value v_ip, value v_mac) {
+    CAMLparam3 (v_interface, v_ip, v_mac);
+
     wifi_interface_t interface;
     switch (v_interface) {
         case ML_WIFI_IF_AP:
@@ -519,27 +744,256 @@ value ml_wifi_get_mac(value v_interface) {
         case ML_WIFI_IF_STA:
             interface = WIFI_IF_STA;
             break;
+        default:
+            CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
     }
-    v_result = caml_alloc_string(6);
 
-    if (esp_wifi_get_mac(interface, Bytes_val(v_result)) != ESP_OK) {
-        CAMLreturn (result_fail(0));
+    if (caml_string_length(v_ip) != 4 || caml_string_length(v_mac) != 6) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+    if (wifi_arp_add_binding(interface, Bytes_val(v_ip), Bytes_val(v_mac)) != WIFI_ERR_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_OUT_OF_MEMORY));
+    }
+
+    CAMLreturn (result_ok(Val_unit));
+}
+
+CAMLprim 
+value ml_wifi_arp_remove_binding(value v_interface, value v_ip) {
+    CAMLparam2 (v_interface, v_ip);
+
+    wifi_interface_t interface;
+    switch (v_interface) {
+        case ML_WIFI_IF_AP:
+            interface = WIFI_IF_AP;
+            break;
+        case ML_WIFI_IF_STA:
+            interface = WIFI_IF_STA;
+            break;
+        default:
+            CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+
+    if (caml_string_length(v_ip) != 4 
+        || wifi_arp_remove_binding(interface, Bytes_val(v_ip)) != WIFI_ERR_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+
+    CAMLreturn (result_ok(Val_unit));
+}
+
+CAMLprim
+value ml_wifi_arp_get_stats(value unit) {
+    CAMLparam0 ();
+    CAMLlocal1 (v_result);
+
+    wifi_arp_stats st = wifi_arp_get_stats();
+    v_result = caml_alloc_tuple(2);
+    Store_field(v_result, 0, Val_int(st.answered));
+    Store_field(v_result, 1, Val_int(st.passed_up));
+
+    CAMLreturn (v_result);
+}
+
+#define ML_WIFI_MAX_LINK_EVENTS 32
+
+CAMLprim
+value ml_wifi_link_events_drain(value unit) {
+    CAMLparam0 ();
+    CAMLlocal3 (v_result, v_event, v_field);
+
+    wifi_link_event_t events[ML_WIFI_MAX_LINK_EVENTS];
+    int count = wifi_link_events_drain(events, ML_WIFI_MAX_LINK_EVENTS);
+
+    if (count == 0) {
+        CAMLreturn (Atom(0));
+    }
+
+    v_result = caml_alloc_tuple(count);
+    for (int i=0;i<count;i++) {
+        v_event = caml_alloc_tuple(6);
+        v_field = caml_copy_int64(events[i].timestamp_us);
+        Store_field(v_event, 0, v_field);
+        Store_field(v_event, 1, Val_int(events[i].kind));
+        Store_field(v_event, 2, Val_int(events[i].reason));
+        Store_field(v_event, 3, Val_int(events[i].channel));
+        Store_field(v_event, 4, Val_int(events[i].aid));
+        v_field = caml_alloc_initialized_string(6, events[i].addr);
+        Store_field(v_event, 5, v_field);
+        Store_field(v_result, i, v_event);
     }
 
+    CAMLreturn (v_result);
+}
+
+CAMLprim
+value ml_wifi_link_events_overflow(value unit) {
+    return Val_int(wifi_link_events_overflow());
+}
+
+CAMLprim
+value ml_wifi_set_rx_coalescing(value v_max_frames, value v_max_delay_us) {
+    CAMLparam2 (v_max_frames, v_max_delay_us);
+
+    if (Long_val(v_max_frames) < 0 || Long_val(v_max_delay_us) < 0 
+        || wifi_set_rx_coalescing(Long_val(v_max_frames), Long_val(v_max_delay_us)) != WIFI_ERR_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+
+    CAMLreturn (result_ok(Val_unit));
+}
+
+CAMLprim
+value ml_wifi_get_rx_stats(value v_interface) {
+    CAMLparam1 (v_interface);
+    CAMLlocal1 (v_result);
+
+    wifi_rx_stats st = wifi_get_rx_stats(ml_wifi_interfaces[Int_val(v_interface)]);
+    v_result = caml_alloc_tuple(2);
+    Store_field(v_result, 0, Val_int(st.frames));
+    Store_field(v_result, 1, Val_int(st.wakeups));
+
+    CAMLreturn (v_result);
+}
+
+static value ml_wifi_alloc_histogram(uint32_t* histogram) {
+    CAMLparam0 ();
+    CAMLlocal1 (v_histogram);
+    v_histogram = caml_alloc_tuple(WIFI_HISTOGRAM_BUCKETS);
+    for (int i=0;i<WIFI_HISTOGRAM_BUCKETS;i++) {
+        Store_field(v_histogram, i, Val_int(histogram[i]));
+    }
+    CAMLreturn (v_histogram);
+}
+
+CAMLprim
+value ml_wifi_get_histograms(value v_interface, value v_reset) {
+    CAMLparam2 (v_interface, v_reset);
+    CAMLlocal2 (v_result, v_histogram);
+
+    wifi_histograms histograms;
+    if (wifi_get_histograms(ml_wifi_interfaces[Int_val(v_interface)], &histograms, Bool_val(v_reset)) != WIFI_ERR_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_INVALID_ARGUMENT));
+    }
+
+    v_result = caml_alloc_tuple(2);
+    v_histogram = ml_wifi_alloc_histogram(histograms.dwell);
+    Store_field(v_result, 0, v_histogram);
+    v_histogram = ml_wifi_alloc_histogram(histograms.tx);
+    Store_field(v_result, 1, v_histogram);
+
     CAMLreturn (result_ok(v_result));
 }
 
+#if WIFI_ENABLE_STA
 CAMLprim
-value ml_wifi_get_status(value unit) {
+value ml_wifi_fast_join_configure(value v_enabled, value v_persistent) {
+    wifi_fast_join_configure(Bool_val(v_enabled), Bool_val(v_persistent));
+    return Val_unit;
+}
+
+CAMLprim
+value ml_wifi_fast_join_forget(value unit) {
+    wifi_fast_join_forget();
+    return Val_unit;
+}
+
+CAMLprim
+value ml_wifi_fast_join_get_stats(value unit) {
     CAMLparam0 ();
-    CAMLlocal1 (v_result); 
+    CAMLlocal2 (v_result, v_join_us);
 
-    wifi_status st = wifi_get_status();
+    wifi_fast_join_stats st = wifi_fast_join_get_stats();
+    v_join_us = caml_copy_int64(st.last_join_us);
     v_result = caml_alloc_tuple(4);
-    Store_field(v_result, 0, Val_bool(st.wifi_inited));
-    Store_field(v_result, 1, Val_bool(st.ap_started));
-    Store_field(v_result, 2, Val_bool(st.sta_started));
-    Store_field(v_result, 3, Val_bool(st.sta_connected));
+    Store_field(v_result, 0, v_join_us);
+    Store_field(v_result, 1, Val_bool(st.last_targeted));
+    Store_field(v_result, 2, Val_int(st.targeted_joins));
+    Store_field(v_result, 3, Val_int(st.fallbacks));
 
     CAMLreturn (v_result);
-}
\ No newline at end of file
+}
+#else
+CAMLprim
+value ml_wifi_fast_join_configure(value v_enabled, value v_persistent) {
+    return Val_unit;
+}
+
+CAMLprim
+value ml_wifi_fast_join_forget(value unit) {
+    return Val_unit;
+}
+
+CAMLprim
+value ml_wifi_fast_join_get_stats(value unit) {
+    CAMLparam0 ();
+    CAMLlocal2 (v_result, v_join_us);
+
+    /* No join yet. */
+    v_join_us = caml_copy_int64(-1);
+    v_result = caml_alloc_tuple(4);
+    Store_field(v_result, 0, v_join_us);
+    Store_field(v_result, 1, Val_bool(false));
+    Store_field(v_result, 2, Val_int(0));
+    Store_field(v_result, 3, Val_int(0));
+
+    CAMLreturn (v_result);
+}
+#endif
+
+#if WIFI_ENABLE_BRIDGE
+CAMLprim
+value ml_wifi_bridge_set_enabled(value v_enabled) {
+    CAMLparam1 (v_enabled);
+
+    if (wifi_bridge_set_enabled(Bool_val(v_enabled)) != ESP_OK) {
+        CAMLreturn (result_fail(ML_WIFI_ERROR_UNSPECIFIED));
+    }
+
+    CAMLreturn (result_ok(Val_unit));
+}
+
+CAMLprim
+value ml_wifi_bridge_set_aging(value v_aging_s) {
+    wifi_bridge_set_aging(Long_val(v_aging_s));
+    return Val_unit;
+}
+
+CAMLprim
+value ml_wifi_bridge_set_rate_limit(value v_direction, value v_frames_per_s, value v_burst) {
+    wifi_bridge_set_rate_limit(Int_val(v_direction), Long_val(v_frames_per_s), Long_val(v_burst));
+    return Val_unit;
+}
+
+CAMLprim
+value ml_wifi_bridge_get_stats(value unit) {
+    CAMLparam0 ();
+    CAMLlocal1 (v_result);
+
+    wifi_bridge_stats st = wifi_bridge_get_stats();
+    v_result = caml_alloc_tuple(7);
+    Store_field(v_result, 0, Val_int(st.forwarded[WIFI_BRIDGE_STA_TO_AP]));
+    Store_field(v_result, 1, Val_int(st.forwarded[WIFI_BRIDGE_AP_TO_STA]));
+    Store_field(v_result, 2, Val_int(st.rate_limited[WIFI_BRIDGE_STA_TO_AP]));
+    Store_field(v_result, 3, Val_int(st.rate_limited[WIFI_BRIDGE_AP_TO_STA]));
+    Store_field(v_result, 4, Val_int(st.punted));
+    Store_field(v_result, 5, Val_int(st.filtered));
+    Store_field(v_result, 6, Val_int(st.tx_failed));
+
+    CAMLreturn (v_result);
+}
+#else
+ML_WIFI_UNSUPPORTED(ml_wifi_bridge_set_enabled)
+
+CAMLprim
+value ml_wifi_bridge_set_aging(value v_aging_s) {
+    return Val_unit;
+}
+
+CAMLprim
+value ml_wifi_bridge_set_rate_limit(value v_direction, value v_frames_per_s, value v_burst) {
+    return Val_unit;
+}
+
+ML_WIFI_UNSUPPORTED_STATS(ml_wifi_bridge_get_stats, 7)
+#endif